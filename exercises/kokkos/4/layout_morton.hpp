@@ -0,0 +1,141 @@
+#ifndef KOKKOS_LAYOUT_MORTON_HPP
+#define KOKKOS_LAYOUT_MORTON_HPP
+
+#include <cassert>
+#include <cstddef>
+#include <type_traits>
+
+#include <Kokkos_Core.hpp>
+
+#include "../../morton-order/bits.hpp"
+
+// A Kokkos array layout that stores a 2D View in Morton (Z) order,
+// using morton::encode from the morton-order exercise.
+//
+// Use it like any other layout:
+//
+//   Kokkos::View<double**, LayoutMorton, Kokkos::HostSpace> A("A", N, M);
+//
+// Rank 1 Views are stored as normal, so vectors can share the Layout
+// with the matrix.
+//
+// NB:
+//
+//  - both extents must be powers of 2. If they differ, the View is
+//    cut into square Morton tiles of the smaller extent, stored one
+//    after another along the longer one, so there is no padding
+//
+//  - morton::encode is a plain host function, so these Views can only
+//    be used from host execution spaces (Serial, OpenMP, Threads)
+//
+//  - Kokkos has no public interface for new layouts. This plugs into
+//    the ViewOffset mapping in Kokkos::Impl, as the built in layouts
+//    do, following Kokkos 2.x. It has only been compiled against a
+//    stand-in for that interface so far, not a real Kokkos build, so
+//    exercise 4 doesn't use it by default.
+struct LayoutMorton {
+  typedef LayoutMorton array_layout;
+
+  size_t dimension[ARRAY_LAYOUT_MAX_RANK];
+
+  enum { is_extent_constructible = true };
+
+  LayoutMorton(LayoutMorton const&) = default;
+  LayoutMorton& operator=(LayoutMorton const&) = default;
+
+  KOKKOS_INLINE_FUNCTION
+  explicit constexpr LayoutMorton(size_t N0 = 0, size_t N1 = 0, size_t N2 = 0, size_t N3 = 0,
+				  size_t N4 = 0, size_t N5 = 0, size_t N6 = 0, size_t N7 = 0)
+    : dimension{N0, N1, N2, N3, N4, N5, N6, N7} {
+  }
+};
+
+namespace Kokkos {
+  namespace Impl {
+
+    template<class Dimension>
+    struct ViewOffset<Dimension, LayoutMorton,
+		      typename std::enable_if<(Dimension::rank <= 2)>::type> {
+      using is_mapping_plugin = std::true_type;
+      // Not strided, so no subviews or assignment to LayoutStride
+      using is_regular = std::false_type;
+
+      typedef size_t size_type;
+      typedef Dimension dimension_type;
+      typedef LayoutMorton array_layout;
+
+      dimension_type m_dim;
+      // log2 of the side of the square tiles
+      unsigned m_shift;
+
+      // Rank 1 is stored contiguously
+      template<typename I0>
+      KOKKOS_INLINE_FUNCTION size_type operator()(I0 const& i0) const {
+	return i0;
+      }
+
+      template<typename I0, typename I1>
+      KOKKOS_INLINE_FUNCTION size_type operator()(I0 const& i0, I1 const& i1) const {
+	const size_type tile_size = size_type(1) << (2 * m_shift);
+	const size_type mask = (size_type(1) << m_shift) - 1;
+	// Only one of these is ever non-zero
+	const size_type tile = (size_type(i0) >> m_shift) + (size_type(i1) >> m_shift);
+	return tile * tile_size + morton::encode(i0 & mask, i1 & mask);
+      }
+
+      KOKKOS_INLINE_FUNCTION
+      array_layout layout() const {
+	return dimension_type::rank == 2 ? array_layout(m_dim.N0, m_dim.N1) : array_layout(m_dim.N0);
+      }
+
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_0() const { return m_dim.N0; }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_1() const {
+	return dimension_type::rank == 2 ? size_type(m_dim.N1) : 1;
+      }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_2() const { return 1; }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_3() const { return 1; }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_4() const { return 1; }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_5() const { return 1; }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_6() const { return 1; }
+      KOKKOS_INLINE_FUNCTION constexpr size_type dimension_7() const { return 1; }
+
+      KOKKOS_INLINE_FUNCTION constexpr size_type size() const {
+	return dimension_0() * dimension_1();
+      }
+      // Tiles are packed, so the span is exactly the size
+      KOKKOS_INLINE_FUNCTION constexpr size_type span() const {
+	return size();
+      }
+      KOKKOS_INLINE_FUNCTION constexpr bool span_is_contiguous() const {
+	return true;
+      }
+
+      // There are no strides, so stride_0() etc. and stride() are left
+      // out: code that asks for them fails to compile rather than
+      // silently getting wrong offsets.
+
+      ViewOffset() = default;
+      ViewOffset(const ViewOffset&) = default;
+      ViewOffset& operator=(const ViewOffset&) = default;
+
+      template<unsigned TrivialScalarSize>
+      ViewOffset(std::integral_constant<unsigned, TrivialScalarSize> const&,
+		 LayoutMorton const& arg_layout)
+	: m_dim(arg_layout.dimension[0], arg_layout.dimension[1], 0, 0, 0, 0, 0, 0),
+	  m_shift(0) {
+	const size_t n0 = dimension_0(), n1 = dimension_1();
+	assert((n0 & (n0 - 1)) == 0 && (n1 & (n1 - 1)) == 0);
+	const size_t side = n0 < n1 ? n0 : n1;
+	while ((size_t(1) << m_shift) < side)
+	  ++m_shift;
+      }
+
+      template<class DimRHS>
+      ViewOffset(const ViewOffset<DimRHS, LayoutMorton, void>& rhs)
+	: m_dim(rhs.m_dim.N0, rhs.m_dim.N1, 0, 0, 0, 0, 0, 0), m_shift(rhs.m_shift) {
+	static_assert(int(DimRHS::rank) == int(dimension_type::rank), "ViewOffset assignment requires equal rank");
+      }
+    };
+  }
+}
+#endif
@@ -0,0 +1,49 @@
+// Benchmark the bit-packed Morton Game of Life.
+//
+// Usage: bench_life [-n log2(tiles per side)] [-steps S] [-threads T]
+// The grid has (8 * 2^n)^2 cells, randomly filled at 1/3 density.
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "life.hpp"
+
+int main(int argc, char* argv[]) {
+  int logn = 10;
+  int steps = 100;
+  unsigned nthreads = 0;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+      logn = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-steps") == 0 && i + 1 < argc) {
+      steps = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      nthreads = std::atoi(argv[++i]);
+    } else {
+      std::printf("Usage: %s [-n log2(tiles per side)] [-steps S] [-threads T]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  morton::life_grid grid(1U << logn);
+  uint64_t state = 42;
+  for (uint32_t y = 0; y < grid.size(); ++y)
+    for (uint32_t x = 0; x < grid.size(); ++x) {
+      state = state * 6364136223846793005UL + 1442695040888963407UL;
+      grid.set(x, y, (state >> 40) % 3 == 0);
+    }
+
+  using clock = std::chrono::high_resolution_clock;
+  auto start = clock::now();
+  for (int s = 0; s < steps; ++s)
+    grid.step(nthreads);
+  auto dt = std::chrono::duration<double>(clock::now() - start).count();
+
+  const double cells = double(grid.size()) * grid.size();
+  std::printf("Grid %u x %u, %d steps, %g s, %g cell updates/s, population %llu, active tiles %llu\n",
+	      grid.size(), grid.size(), steps, dt, cells * steps / dt,
+	      (unsigned long long)grid.population(),
+	      (unsigned long long)grid.active_tiles());
+  return 0;
+}
@@ -46,6 +46,44 @@ namespace morton {
     y = pack(j);
   }
 
+  // 3D versions of the above. Only the low 21 bits of each index fit
+  // in the 64 bit code. Go from bit pattern like
+  //         abcd
+  // to:
+  //   00a00b00c00d
+  inline uint64_t split3(const uint32_t a) {
+    uint64_t x = a & 0x1fffff;
+    x = (x | x << 32) & 0x001f00000000ffffUL;
+    x = (x | x << 16) & 0x001f0000ff0000ffUL;
+    x = (x | x <<  8) & 0x100f00f00f00f00fUL;
+    x = (x | x <<  4) & 0x10c30c30c30c30c3UL;
+    x = (x | x <<  2) & 0x1249249249249249UL;
+    return x;
+  }
+
+  // Reverse the above
+  inline uint32_t pack3(const uint64_t z) {
+    uint64_t x = z & 0x1249249249249249UL;
+    x = (x | x >>  2) & 0x10c30c30c30c30c3UL;
+    x = (x | x >>  4) & 0x100f00f00f00f00fUL;
+    x = (x | x >>  8) & 0x001f0000ff0000ffUL;
+    x = (x | x >> 16) & 0x001f00000000ffffUL;
+    x = (x | x >> 32) & 0x00000000001fffffUL;
+    return x;
+  }
+
+  // Compute the 3d Morton code for a triple of indices
+  inline uint64_t encode(const uint32_t x, const uint32_t y, const uint32_t z) {
+    return split3(x) | split3(y) << 1 | split3(z) << 2;
+  }
+
+  // Compute the 3 indices from a 3d Morton index
+  inline void decode(const uint64_t m, uint32_t& x, uint32_t& y, uint32_t& z) {
+    x = pack3(m);
+    y = pack3(m >> 1);
+    z = pack3(m >> 2);
+  }
+
   const uint64_t odd_bit_mask = 0x5555555555555555UL;
   const uint64_t even_bit_mask = 0xaaaaaaaaaaaaaaaaUL;
 
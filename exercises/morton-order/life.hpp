@@ -0,0 +1,181 @@
+#ifndef MORTON_LIFE_HPP
+#define MORTON_LIFE_HPP
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include "bits.hpp"
+#include "parallel.hpp"
+
+namespace morton {
+
+  // Conway's Game of Life on a bit-packed grid.
+  //
+  // The grid is made of 8x8 tiles, each stored as the bits of one
+  // uint64_t (bit 8*y + x is cell (x, y) of the tile). The tiles are
+  // stored in Morton order, so the neighbours of a tile are found
+  // with inc_x/dec_x/inc_y/dec_y on its index and are usually close
+  // by in memory.
+  //
+  // A tile is updated all at once with bitwise operations (SWAR):
+  // the eight neighbour boards are built by shifting the tile and
+  // pulling in edge bits from the neighbouring tiles, then added up
+  // in parallel with a bit-sliced adder.
+  //
+  // Tiles are only recomputed if they or a neighbour changed in the
+  // last generation, so still and empty regions cost next to nothing.
+  //
+  // Cells outside the grid are always dead.
+  class life_grid {
+  public:
+    // tiles is the number of tiles along each side, a power of 2
+    explicit life_grid(uint32_t tiles)
+      : _tiles(tiles), _cur(uint64_t(tiles) * tiles, 0), _next(_cur.size(), 0),
+	_changed(_cur.size(), 0), _next_changed(_cur.size(), 0),
+	_generation(0) {
+      assert((tiles & (tiles-1)) == 0);
+    }
+
+    // Number of cells along each side
+    uint32_t size() const {
+      return 8 * _tiles;
+    }
+    uint64_t generation() const {
+      return _generation;
+    }
+
+    bool get(uint32_t x, uint32_t y) const {
+      return (_cur[encode(x / 8, y / 8)] >> bit(x, y)) & 1;
+    }
+    void set(uint32_t x, uint32_t y, bool alive) {
+      const auto t = encode(x / 8, y / 8);
+      const uint64_t m = uint64_t(1) << bit(x, y);
+      _cur[t] = alive ? (_cur[t] | m) : (_cur[t] & ~m);
+      // Make sure it and its neighbours get looked at next step
+      _changed[t] = 1;
+    }
+
+    // Raw tiles, in Morton order
+    const std::vector<uint64_t>& tiles() const {
+      return _cur;
+    }
+
+    // Advance one generation
+    void step(unsigned nthreads = 0) {
+      const std::size_t n = _cur.size();
+      nthreads = thread_count(nthreads, n, 1 << 12);
+      // Each thread gets a contiguous run of Morton indices, i.e. a
+      // compact block of quadrants.
+      parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned) {
+	  for (std::size_t t = b; t < e; ++t)
+	    update(t);
+	});
+      _cur.swap(_next);
+      _changed.swap(_next_changed);
+      ++_generation;
+    }
+
+    // Number of live cells
+    uint64_t population() const {
+      uint64_t ans = 0;
+      for (auto t: _cur)
+	ans += __builtin_popcountll(t);
+      return ans;
+    }
+
+    // Number of tiles that changed in the last step
+    uint64_t active_tiles() const {
+      uint64_t ans = 0;
+      for (auto c: _changed)
+	ans += c;
+      return ans;
+    }
+
+  private:
+    static unsigned bit(uint32_t x, uint32_t y) {
+      return 8 * (y % 8) + (x % 8);
+    }
+
+    static const uint64_t col0 = 0x0101010101010101UL;
+    static const uint64_t col7 = 0x8080808080808080UL;
+
+    // Boards whose bit (x, y) is cell (x+1, y), (x-1, y), (x, y-1)
+    // or (x, y+1) of the tile b, where e/w/n/s is the tile on that side
+    static uint64_t east(uint64_t b, uint64_t e) {
+      return ((b >> 1) & ~col7) | ((e & col0) << 7);
+    }
+    static uint64_t west(uint64_t b, uint64_t w) {
+      return ((b << 1) & ~col0) | ((w & col7) >> 7);
+    }
+    static uint64_t north(uint64_t b, uint64_t n) {
+      return (b << 8) | (n >> 56);
+    }
+    static uint64_t south(uint64_t b, uint64_t s) {
+      return (b >> 8) | (s << 56);
+    }
+
+    bool valid(uint64_t t) const {
+      return pack(t) < _tiles && pack(t >> 1) < _tiles;
+    }
+    uint64_t tile(uint64_t t) const {
+      return valid(t) ? _cur[t] : 0;
+    }
+    bool changed(uint64_t t) const {
+      return valid(t) && _changed[t];
+    }
+
+    void update(uint64_t t) {
+      // Neighbouring tile indices. y increases "south".
+      const uint64_t tw = dec_x(t), te = inc_x(t);
+      const uint64_t tn = dec_y(t), ts = inc_y(t);
+      const uint64_t tnw = dec_y(tw), tne = dec_y(te);
+      const uint64_t tsw = inc_y(tw), tse = inc_y(te);
+
+      const uint64_t c = _cur[t];
+      if (!(_changed[t] || changed(tw) || changed(te) || changed(tn) || changed(ts) ||
+	    changed(tnw) || changed(tne) || changed(tsw) || changed(tse))) {
+	_next[t] = c;
+	_next_changed[t] = 0;
+	return;
+      }
+
+      const uint64_t w = tile(tw), e = tile(te), n = tile(tn), s = tile(ts);
+      const uint64_t nw = tile(tnw), ne = tile(tne), sw = tile(tsw), se = tile(tse);
+
+      // Horizontally shifted versions of this tile and the rows above
+      // and below, then shift those vertically for the diagonals.
+      const uint64_t cE = east(c, e), cW = west(c, w);
+      const uint64_t nE = east(n, ne), nW = west(n, nw);
+      const uint64_t sE = east(s, se), sW = west(s, sw);
+
+      const uint64_t nb[8] = {
+	cE, cW,
+	north(c, n), south(c, s),
+	north(cE, nE), north(cW, nW),
+	south(cE, sE), south(cW, sW)
+      };
+
+      // Bit-sliced add of the eight boards: count mod 8 in (s2 s1 s0).
+      // A count of 8 wraps to 0, which is fine since it's a death too.
+      uint64_t s0 = 0, s1 = 0, s2 = 0;
+      for (auto a: nb) {
+	const uint64_t c0 = s0 & a;
+	s0 ^= a;
+	const uint64_t c1 = s1 & c0;
+	s1 ^= c0;
+	s2 ^= c1;
+      }
+      // Alive next if count == 3, or alive now and count == 2
+      const uint64_t next = s1 & ~s2 & (s0 | c);
+      _next[t] = next;
+      _next_changed[t] = next != c;
+    }
+
+    uint32_t _tiles;
+    std::vector<uint64_t> _cur, _next;
+    // Did each tile change in the last step (and so will the next one)
+    std::vector<uint8_t> _changed, _next_changed;
+    uint64_t _generation;
+  };
+}
+#endif
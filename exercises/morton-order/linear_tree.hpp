@@ -0,0 +1,366 @@
+#ifndef MORTON_LINEAR_TREE_HPP
+#define MORTON_LINEAR_TREE_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <queue>
+#include <utility>
+#include <vector>
+#include "bits.hpp"
+#include "parallel.hpp"
+#include "point_set.hpp"
+
+namespace morton {
+
+  // Implicit linear quadtree (2D) or octree (3D) over Morton sorted
+  // points.
+  //
+  // There are no node objects or pointers. All the points in a node
+  // share a Morton prefix, so because the keys are sorted each node
+  // is a contiguous range of them. For each level we store the
+  // positions where the prefix changes, i.e. where each node starts.
+  // The children of a node are then the next level's boundaries that
+  // fall within its range.
+  //
+  // Building a level is one O(n) pass over the sorted keys. Updates
+  // are done in batches: the batch is sorted, merged into the sorted
+  // arrays and the boundaries rebuilt, all in O(n + m log m).
+  template<int D, class Real = double>
+  class linear_tree {
+  public:
+    using pset = point_set<D, Real>;
+    using point = typename pset::point;
+    // Levels of the tree are 0 (root) to this
+    static const unsigned max_depth = pset::bits_per_dim;
+    // Below this many points, just scan them
+    static const std::size_t leaf_size = 16;
+
+    // Build from a sorted point set. max_level = 0 means choose it
+    // from the number of points.
+    explicit linear_tree(const pset& ps, unsigned max_level = 0, unsigned nthreads = 0)
+      : _frame(std::vector<point>(), ps.lo(), ps.hi()),
+	_points(ps.points()), _keys(ps.keys()), _ids(ps.permutation()),
+	_next_id(ps.size()) {
+      if (max_level == 0) {
+	const double per_level = std::log2(std::max<std::size_t>(_points.size(), 1) / double(leaf_size)) / D;
+	max_level = unsigned(std::max(1.0, std::ceil(per_level) + 1));
+      }
+      _max_level = std::min(max_level, unsigned(max_depth));
+      rebuild(nthreads);
+    }
+
+    std::size_t size() const {
+      return _points.size();
+    }
+    unsigned max_level() const {
+      return _max_level;
+    }
+
+    // Data in Morton order. ids()[k] identifies the k'th point: the
+    // points from the original set have their input position as id,
+    // inserted points get new ids counting up from there.
+    const std::vector<point>& points() const {
+      return _points;
+    }
+    const std::vector<uint64_t>& keys() const {
+      return _keys;
+    }
+    const std::vector<uint32_t>& ids() const {
+      return _ids;
+    }
+
+    // Positions of the starts of the nodes at a level
+    const std::vector<uint32_t>& level(unsigned l) const {
+      return _levels[l];
+    }
+
+    // Positions (in Morton order) of all points p with lo <= p <= hi
+    std::vector<std::size_t> box_query(const point& lo, const point& hi) const {
+      std::vector<std::size_t> ans;
+      if (!_points.empty())
+	box_query(0, 0, _points.size(), lo, hi, ans);
+      return ans;
+    }
+
+    // Positions of the k nearest points to q, nearest first
+    std::vector<std::size_t> knn(const point& q, std::size_t k) const {
+      std::vector<std::size_t> ans;
+      k = std::min(k, _points.size());
+      if (k == 0)
+	return ans;
+
+      // Best candidates so far, furthest on top
+      std::priority_queue<std::pair<Real, std::size_t>> best;
+      // Nodes to visit, nearest on top
+      using node_entry = std::pair<Real, std::pair<unsigned, std::size_t>>;
+      std::priority_queue<node_entry, std::vector<node_entry>, std::greater<node_entry>> todo;
+      todo.push({Real(0), {0U, std::size_t(0)}});
+
+      while (!todo.empty()) {
+	auto top = todo.top();
+	todo.pop();
+	if (best.size() == k && top.first > best.top().first)
+	  break;
+
+	const unsigned l = top.second.first;
+	const std::size_t b = top.second.second;
+	const std::size_t e = node_end(l, b);
+
+	if (l == _max_level || e - b <= leaf_size) {
+	  for (std::size_t i = b; i < e; ++i) {
+	    auto d2 = dist2(q, _points[i]);
+	    if (best.size() < k) {
+	      best.push({d2, i});
+	    } else if (d2 < best.top().first) {
+	      best.pop();
+	      best.push({d2, i});
+	    }
+	  }
+	  continue;
+	}
+
+	for_each_child(l, b, e, [&](std::size_t cb, std::size_t) {
+	    point nlo, nhi;
+	    node_box(l + 1, _keys[cb], nlo, nhi);
+	    todo.push({box_dist2(q, nlo, nhi), {l + 1, cb}});
+	  });
+      }
+
+      ans.resize(best.size());
+      for (std::size_t i = ans.size(); i-- > 0;) {
+	ans[i] = best.top().second;
+	best.pop();
+      }
+      return ans;
+    }
+
+    // Add a batch of points. If any are outside the box the keys were
+    // made in, the box is grown to take them and the existing points
+    // re-keyed first, which costs a full sort. Returns the ids given
+    // to the new points.
+    std::vector<uint32_t> insert(const std::vector<point>& batch, unsigned nthreads = 0) {
+      grow_frame(batch, nthreads);
+      const std::size_t m = batch.size();
+      std::vector<uint64_t> bkeys(m);
+      std::vector<uint32_t> new_ids(m);
+      for (std::size_t i = 0; i < m; ++i) {
+	bkeys[i] = _frame.key_of(batch[i]);
+	new_ids[i] = _next_id++;
+      }
+      std::vector<uint32_t> bperm;
+      radix_sort(bkeys, bperm, nthreads);
+
+      // Merge the two sorted sequences
+      const std::size_t n = _points.size();
+      std::vector<point> points(n + m);
+      std::vector<uint64_t> keys(n + m);
+      std::vector<uint32_t> ids(n + m);
+      std::size_t i = 0, j = 0;
+      for (std::size_t out = 0; out < n + m; ++out) {
+	if (j == m || (i < n && _keys[i] <= bkeys[j])) {
+	  points[out] = _points[i];
+	  keys[out] = _keys[i];
+	  ids[out] = _ids[i];
+	  ++i;
+	} else {
+	  points[out] = batch[bperm[j]];
+	  keys[out] = bkeys[j];
+	  ids[out] = new_ids[bperm[j]];
+	  ++j;
+	}
+      }
+      _points.swap(points);
+      _keys.swap(keys);
+      _ids.swap(ids);
+      rebuild(nthreads);
+      return new_ids;
+    }
+
+    // Remove a batch of points by id
+    void erase(std::vector<uint32_t> remove, unsigned nthreads = 0) {
+      std::sort(remove.begin(), remove.end());
+      std::size_t out = 0;
+      for (std::size_t i = 0; i < _points.size(); ++i) {
+	if (std::binary_search(remove.begin(), remove.end(), _ids[i]))
+	  continue;
+	_points[out] = _points[i];
+	_keys[out] = _keys[i];
+	_ids[out] = _ids[i];
+	++out;
+      }
+      _points.resize(out);
+      _keys.resize(out);
+      _ids.resize(out);
+      rebuild(nthreads);
+    }
+
+  private:
+    // Morton prefix of a key at a level
+    static uint64_t prefix(uint64_t key, unsigned l) {
+      const unsigned shift = D * (max_depth - l);
+      return shift >= 64 ? 0 : key >> shift;
+    }
+
+    // Make sure the frame covers the batch as well as the points we
+    // have. Clamping outside points to the edge cells instead would
+    // put them in nodes whose boxes don't contain them.
+    void grow_frame(const std::vector<point>& batch, unsigned nthreads) {
+      point lo = _frame.lo(), hi = _frame.hi();
+      bool grown = false;
+      for (auto& p: batch)
+	for (int d = 0; d < D; ++d) {
+	  if (p[d] < lo[d]) {
+	    lo[d] = p[d];
+	    grown = true;
+	  }
+	  if (p[d] > hi[d]) {
+	    hi[d] = p[d];
+	    grown = true;
+	  }
+	}
+      if (!grown)
+	return;
+      _frame = pset(std::vector<point>(), lo, hi);
+
+      std::vector<uint64_t> keys(_points.size());
+      for (std::size_t i = 0; i < _points.size(); ++i)
+	keys[i] = _frame.key_of(_points[i]);
+      std::vector<uint32_t> perm;
+      radix_sort(keys, perm, nthreads);
+      std::vector<point> points(_points.size());
+      std::vector<uint32_t> ids(_points.size());
+      for (std::size_t k = 0; k < perm.size(); ++k) {
+	points[k] = _points[perm[k]];
+	ids[k] = _ids[perm[k]];
+      }
+      _points.swap(points);
+      _keys.swap(keys);
+      _ids.swap(ids);
+    }
+
+    void rebuild(unsigned nthreads) {
+      const std::size_t n = _keys.size();
+      nthreads = thread_count(nthreads, n);
+      _levels.assign(_max_level + 1, std::vector<uint32_t>());
+      if (n == 0)
+	return;
+      _levels[0].push_back(0);
+
+      std::vector<std::vector<uint32_t>> parts(nthreads);
+      for (unsigned l = 1; l <= _max_level; ++l) {
+	parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned t) {
+	    auto& part = parts[t];
+	    part.clear();
+	    for (std::size_t i = b; i < e; ++i)
+	      if (i == 0 || prefix(_keys[i], l) != prefix(_keys[i-1], l))
+		part.push_back(i);
+	  });
+	for (auto& part: parts)
+	  _levels[l].insert(_levels[l].end(), part.begin(), part.end());
+      }
+    }
+
+    // End of the node at level l starting at position b
+    std::size_t node_end(unsigned l, std::size_t b) const {
+      auto& bounds = _levels[l];
+      auto it = std::upper_bound(bounds.begin(), bounds.end(), b);
+      return it == bounds.end() ? _points.size() : *it;
+    }
+
+    // Call f(begin, end) for each child of the node [b, e) at level l
+    template<class F>
+    void for_each_child(unsigned l, std::size_t b, std::size_t e, F f) const {
+      auto& bounds = _levels[l + 1];
+      auto it = std::lower_bound(bounds.begin(), bounds.end(), b);
+      while (it != bounds.end() && *it < e) {
+	std::size_t cb = *it;
+	++it;
+	std::size_t ce = (it == bounds.end()) ? _points.size() : std::min<std::size_t>(*it, e);
+	f(cb, ce);
+      }
+    }
+
+    // Bounding box of the node at level l containing key, widened by
+    // a cell either side to allow for rounding in the quantisation.
+    void node_box(unsigned l, uint64_t key, point& lo, point& hi) const {
+      std::array<uint32_t, D> c;
+      decode_prefix(prefix(key, l), c);
+      const auto cs = _frame.cell_size();
+      const unsigned shift = max_depth - l;
+      for (int d = 0; d < D; ++d) {
+	const double c0 = double(uint64_t(c[d]) << shift);
+	const double c1 = double((uint64_t(c[d]) + 1) << shift);
+	lo[d] = _frame.lo()[d] + Real((c0 - 1) * cs[d]);
+	hi[d] = _frame.lo()[d] + Real((c1 + 1) * cs[d]);
+      }
+    }
+
+    static void decode_prefix(uint64_t p, std::array<uint32_t, 2>& c) {
+      decode(p, c[0], c[1]);
+    }
+    static void decode_prefix(uint64_t p, std::array<uint32_t, 3>& c) {
+      decode(p, c[0], c[1], c[2]);
+    }
+
+    static bool contains(const point& lo, const point& hi, const point& p) {
+      for (int d = 0; d < D; ++d)
+	if (p[d] < lo[d] || p[d] > hi[d])
+	  return false;
+      return true;
+    }
+
+    void box_query(unsigned l, std::size_t b, std::size_t e,
+		   const point& lo, const point& hi,
+		   std::vector<std::size_t>& ans) const {
+      point nlo, nhi;
+      node_box(l, _keys[b], nlo, nhi);
+      bool inside = true;
+      for (int d = 0; d < D; ++d) {
+	if (nhi[d] < lo[d] || nlo[d] > hi[d])
+	  return;
+	inside = inside && lo[d] <= nlo[d] && nhi[d] <= hi[d];
+      }
+      if (inside) {
+	for (std::size_t i = b; i < e; ++i)
+	  ans.push_back(i);
+	return;
+      }
+      if (l == _max_level || e - b <= leaf_size) {
+	for (std::size_t i = b; i < e; ++i)
+	  if (contains(lo, hi, _points[i]))
+	    ans.push_back(i);
+	return;
+      }
+      for_each_child(l, b, e, [&](std::size_t cb, std::size_t ce) {
+	  box_query(l + 1, cb, ce, lo, hi, ans);
+	});
+    }
+
+    static Real dist2(const point& a, const point& b) {
+      Real ans = 0;
+      for (int d = 0; d < D; ++d)
+	ans += (a[d] - b[d]) * (a[d] - b[d]);
+      return ans;
+    }
+    static Real box_dist2(const point& q, const point& lo, const point& hi) {
+      Real ans = 0;
+      for (int d = 0; d < D; ++d) {
+	const Real x = std::max(std::max(lo[d] - q[d], Real(0)), q[d] - hi[d]);
+	ans += x * x;
+      }
+      return ans;
+    }
+
+    // Only used to turn positions into keys
+    pset _frame;
+    unsigned _max_level;
+    std::vector<point> _points;
+    std::vector<uint64_t> _keys;
+    std::vector<uint32_t> _ids;
+    uint32_t _next_id;
+    // _levels[l] holds the start positions of the nodes at level l
+    std::vector<std::vector<uint32_t>> _levels;
+  };
+}
+#endif
@@ -0,0 +1,38 @@
+#ifndef MORTON_PARALLEL_HPP
+#define MORTON_PARALLEL_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+namespace morton {
+  // Work out how many threads to use for n items: 0 means "all the
+  // cores", and there's no point using threads for small jobs.
+  inline unsigned thread_count(unsigned requested, std::size_t n,
+			       std::size_t min_per_thread = 1 << 14) {
+    if (requested == 0)
+      requested = std::max(1U, std::thread::hardware_concurrency());
+    const std::size_t most = std::max<std::size_t>(1, n / min_per_thread);
+    return unsigned(std::min<std::size_t>(requested, most));
+  }
+
+  // Split [0, n) into nthreads contiguous chunks and call
+  // f(begin, end, thread_index) for each chunk on its own thread.
+  // The split only depends on n and nthreads, so calling this twice
+  // with the same arguments gives each thread the same chunk.
+  template<class F>
+  void parallel_for(std::size_t n, unsigned nthreads, F f) {
+    if (nthreads <= 1) {
+      f(std::size_t(0), n, 0U);
+      return;
+    }
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < nthreads; ++t)
+      threads.emplace_back(f, n * t / nthreads, n * (t + 1) / nthreads, t);
+    f(std::size_t(0), n / nthreads, 0U);
+    for (auto& th: threads)
+      th.join();
+  }
+}
+#endif
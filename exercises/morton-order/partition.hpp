@@ -0,0 +1,171 @@
+#ifndef MORTON_PARTITION_HPP
+#define MORTON_PARTITION_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <limits>
+#include <vector>
+#include "bits.hpp"
+#include "parallel.hpp"
+
+// Space-filling curve domain decomposition.
+//
+// Anything stored in Morton order - the data of a morton::matrix, or
+// the points of a point_set - can be split between P processes by
+// cutting the curve into P contiguous pieces. Pieces of a Z curve are
+// compact blobs, so the halos stay small, and finding the cuts is a
+// single pass over the weights.
+namespace morton {
+
+  // A half-open range [begin, end) of Morton indices or keys
+  struct z_run {
+    uint64_t begin;
+    uint64_t end;
+  };
+
+  inline bool operator==(const z_run& a, const z_run& b) {
+    return a.begin == b.begin && a.end == b.end;
+  }
+
+  // Cut n items, with weights w[0..n) in Morton order, into P
+  // contiguous ranges of (nearly) equal total weight. Returns P+1
+  // cut positions: part p is [cuts[p], cuts[p+1]). Cut k is the
+  // first position where the weight before it reaches k/P of the
+  // total.
+  //
+  // Each thread sums its chunk, then scans it again to place the cuts
+  // that fall inside it, so the weights are read twice in total.
+  template<class W>
+  std::vector<uint64_t> partition_cuts(const W* w, uint64_t n, unsigned P,
+				       unsigned nthreads = 0) {
+    assert(P > 0);
+    std::vector<uint64_t> cuts(P + 1, 0);
+    cuts[P] = n;
+    nthreads = thread_count(nthreads, n);
+
+    std::vector<double> chunk_sum(nthreads + 1, 0.0);
+    parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned t) {
+	double sum = 0;
+	for (std::size_t i = b; i < e; ++i)
+	  sum += w[i];
+	chunk_sum[t + 1] = sum;
+      });
+    // Now chunk_sum[t] is the weight before chunk t
+    for (unsigned t = 0; t < nthreads; ++t)
+      chunk_sum[t + 1] += chunk_sum[t];
+    const double total = chunk_sum[nthreads];
+
+    parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned t) {
+	if (b == e)
+	  return;
+	// This chunk places the cuts with lo < target <= hi, where lo
+	// and hi are the weights before its first and last items.
+	const double lo = b == 0 ? -std::numeric_limits<double>::infinity()
+	  : chunk_sum[t] - w[b - 1];
+	const double hi = e == n ? std::numeric_limits<double>::infinity()
+	  : chunk_sum[t + 1] - w[e - 1];
+	double before = chunk_sum[t];
+	std::size_t i = b;
+	for (unsigned k = 1; k < P; ++k) {
+	  const double target = total * k / P;
+	  if (target <= lo || target > hi)
+	    continue;
+	  while (before < target && i < e) {
+	    before += w[i];
+	    ++i;
+	  }
+	  cuts[k] = i;
+	}
+      });
+    return cuts;
+  }
+
+  // Equal weights: just split the curve evenly
+  inline std::vector<uint64_t> partition_cuts(uint64_t n, unsigned P) {
+    std::vector<uint64_t> cuts(P + 1);
+    for (unsigned p = 0; p <= P; ++p)
+      cuts[p] = n * p / P;
+    return cuts;
+  }
+
+  namespace detail {
+    // Morton indices of the neighbours of z within a rank x rank grid
+    template<class F>
+    void for_each_neighbour(uint64_t z, uint32_t rank, bool diagonals, F f) {
+      // Stepping off the edge of the grid gives an x or y >= rank,
+      // including when decrementing 0 wraps around.
+      auto valid = [rank](uint64_t nz) {
+	return pack(nz) < rank && pack(nz >> 1) < rank;
+      };
+      const uint64_t xs[3] = {dec_x(z), z, inc_x(z)};
+      for (auto x: xs) {
+	const uint64_t ys[3] = {dec_y(x), x, inc_y(x)};
+	for (int k = 0; k < 3; ++k) {
+	  auto nz = ys[k];
+	  if (nz == z)
+	    continue;
+	  if (!diagonals && x != z && k != 1)
+	    continue;
+	  if (valid(nz))
+	    f(nz);
+	}
+      }
+    }
+
+    // Turn a sorted list of indices into runs of consecutive ones
+    inline std::vector<z_run> make_runs(std::vector<uint64_t>& zs) {
+      std::sort(zs.begin(), zs.end());
+      zs.erase(std::unique(zs.begin(), zs.end()), zs.end());
+      std::vector<z_run> runs;
+      for (auto z: zs) {
+	if (!runs.empty() && runs.back().end == z)
+	  ++runs.back().end;
+	else
+	  runs.push_back(z_run{z, z + 1});
+      }
+      return runs;
+    }
+  }
+
+  // The halo of the part [begin, end) of a rank x rank Morton matrix:
+  // the elements outside it that neighbour an element inside it, as
+  // runs of Morton indices. With diagonals = false only the four
+  // edge neighbours count.
+  inline std::vector<z_run> halo_runs(uint32_t rank, uint64_t begin, uint64_t end,
+				      bool diagonals = true) {
+    std::vector<uint64_t> outside;
+    for (uint64_t z = begin; z < end; ++z)
+      detail::for_each_neighbour(z, rank, diagonals, [&](uint64_t nz) {
+	  if (nz < begin || nz >= end)
+	    outside.push_back(nz);
+	});
+    return detail::make_runs(outside);
+  }
+
+  // The halo of the part [begin, end) of a sorted array of 2D point
+  // keys (see point_set<2>), at the resolution of the 2^level x
+  // 2^level grid of cells. That is the cells touched by the part and
+  // their neighbours, as runs of cell Morton indices; a key's cell is
+  // key >> 2*(32 - level). Every point owned by another part that
+  // falls in these cells is in this part's halo, which covers all its
+  // neighbours within one cell width.
+  inline std::vector<z_run> point_halo_runs(const std::vector<uint64_t>& keys,
+					    uint64_t begin, uint64_t end,
+					    unsigned level) {
+    assert(level >= 1 && level < 32);
+    const unsigned shift = 2 * (32 - level);
+    std::vector<uint64_t> cells;
+    for (uint64_t i = begin; i < end; ++i) {
+      auto c = keys[i] >> shift;
+      if (cells.empty() || cells.back() != c)
+	cells.push_back(c);
+    }
+    std::vector<uint64_t> near(cells);
+    for (auto c: cells)
+      detail::for_each_neighbour(c, 1U << level, true, [&](uint64_t nc) {
+	  near.push_back(nc);
+	});
+    return detail::make_runs(near);
+  }
+}
+#endif
@@ -0,0 +1,228 @@
+#ifndef MORTON_POINT_SET_HPP
+#define MORTON_POINT_SET_HPP
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <numeric>
+#include <vector>
+#include "bits.hpp"
+#include "parallel.hpp"
+
+namespace morton {
+
+  // Sort 64 bit keys into ascending order with a parallel LSD radix
+  // sort, one byte per pass. perm is set so that perm[k] is the
+  // original position of the k'th sorted key. The sort is stable.
+  //
+  // Each pass: every thread counts the digits in its chunk, the
+  // counts are turned into output offsets in (digit, thread) order
+  // and then every thread scatters its chunk. Passes where all the
+  // keys have the same digit (e.g. the high bytes of small keys) are
+  // skipped.
+  inline void radix_sort(std::vector<uint64_t>& keys, std::vector<uint32_t>& perm,
+			 unsigned nthreads = 0) {
+    const std::size_t n = keys.size();
+    assert(n <= 0xffffffffUL);
+    perm.resize(n);
+    std::iota(perm.begin(), perm.end(), 0U);
+
+    const unsigned radix = 256;
+    nthreads = thread_count(nthreads, n);
+    std::vector<uint64_t> keys_out(n);
+    std::vector<uint32_t> perm_out(n);
+    std::vector<std::size_t> offset(radix * nthreads);
+
+    for (unsigned shift = 0; shift < 64; shift += 8) {
+      std::fill(offset.begin(), offset.end(), 0);
+      parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned t) {
+	  auto count = &offset[t * radix];
+	  for (std::size_t i = b; i < e; ++i)
+	    ++count[(keys[i] >> shift) & 0xff];
+	});
+
+      bool trivial = false;
+      std::size_t sum = 0;
+      for (unsigned d = 0; d < radix; ++d) {
+	std::size_t total = 0;
+	for (unsigned t = 0; t < nthreads; ++t) {
+	  auto c = offset[t * radix + d];
+	  offset[t * radix + d] = sum + total;
+	  total += c;
+	}
+	trivial = trivial || total == n;
+	sum += total;
+      }
+      if (trivial)
+	continue;
+
+      parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned t) {
+	  auto pos = &offset[t * radix];
+	  for (std::size_t i = b; i < e; ++i) {
+	    auto& p = pos[(keys[i] >> shift) & 0xff];
+	    keys_out[p] = keys[i];
+	    perm_out[p] = perm[i];
+	    ++p;
+	  }
+	});
+      keys.swap(keys_out);
+      perm.swap(perm_out);
+    }
+  }
+
+  namespace detail {
+    inline uint64_t encode_cell(const std::array<uint32_t, 2>& c) {
+      return encode(c[0], c[1]);
+    }
+    inline uint64_t encode_cell(const std::array<uint32_t, 3>& c) {
+      return encode(c[0], c[1], c[2]);
+    }
+  }
+
+  // A set of 2D or 3D points stored in Morton order.
+  //
+  // Coordinates are quantised onto a 2^32 (2D) or 2^21 (3D) grid
+  // spanning the bounding box, and the Morton code of the grid cell
+  // is the key. The points are kept sorted by key, and the
+  // permutation from the input order is kept so other per-point data
+  // can be put in the same order with reorder().
+  template<int D, class Real = double>
+  class point_set {
+    static_assert(D == 2 || D == 3, "Only 2D and 3D points are supported");
+  public:
+    using point = std::array<Real, D>;
+    using cell = std::array<uint32_t, D>;
+    static const unsigned bits_per_dim = D == 2 ? 32 : 21;
+
+    point_set() {
+    }
+
+    // Use the bounding box of the points
+    explicit point_set(std::vector<point> pts, unsigned nthreads = 0) {
+      point lo, hi;
+      bounding_box(pts, lo, hi);
+      init(std::move(pts), lo, hi, nthreads);
+    }
+
+    // Use a given box, e.g. the simulation domain, so keys stay
+    // comparable between steps. Points outside are clamped.
+    point_set(std::vector<point> pts, const point& lo, const point& hi,
+	      unsigned nthreads = 0) {
+      init(std::move(pts), lo, hi, nthreads);
+    }
+
+    std::size_t size() const {
+      return _points.size();
+    }
+
+    // The sorted points and their keys
+    const point& operator[](std::size_t k) const {
+      return _points[k];
+    }
+    const std::vector<point>& points() const {
+      return _points;
+    }
+    const std::vector<uint64_t>& keys() const {
+      return _keys;
+    }
+    // permutation()[k] is the input position of the k'th sorted point
+    const std::vector<uint32_t>& permutation() const {
+      return _perm;
+    }
+
+    const point& lo() const {
+      return _lo;
+    }
+    const point& hi() const {
+      return _hi;
+    }
+
+    // Grid cell and key for an arbitrary position
+    cell cell_of(const point& p) const {
+      cell c;
+      for (int d = 0; d < D; ++d) {
+	// In double, as a float can't hold max_cell() exactly and would
+	// round it up out of the range of uint32_t
+	double x = double(p[d] - _lo[d]) * double(_scale[d]);
+	x = std::min(std::max(x, 0.0), max_cell());
+	c[d] = uint32_t(x);
+      }
+      return c;
+    }
+    uint64_t key_of(const point& p) const {
+      return detail::encode_cell(cell_of(p));
+    }
+
+    // Size of a grid cell in each dimension
+    point cell_size() const {
+      point ans;
+      for (int d = 0; d < D; ++d)
+	ans[d] = _scale[d] > 0 ? Real(1) / _scale[d] : Real(0);
+      return ans;
+    }
+
+    // Put a per-point array (in the original input order) into the
+    // sorted order, in one pass.
+    template<class V>
+    std::vector<V> reorder(const std::vector<V>& attr, unsigned nthreads = 0) const {
+      assert(attr.size() == size());
+      std::vector<V> ans(size());
+      parallel_for(size(), thread_count(nthreads, size()),
+		   [&](std::size_t b, std::size_t e, unsigned) {
+		     for (std::size_t k = b; k < e; ++k)
+		       ans[k] = attr[_perm[k]];
+		   });
+      return ans;
+    }
+
+    static double max_cell() {
+      return double((uint64_t(1) << bits_per_dim) - 1);
+    }
+
+  private:
+    static void bounding_box(const std::vector<point>& pts, point& lo, point& hi) {
+      for (int d = 0; d < D; ++d) {
+	lo[d] = pts.empty() ? Real(0) : pts[0][d];
+	hi[d] = lo[d];
+      }
+      for (auto& p: pts)
+	for (int d = 0; d < D; ++d) {
+	  lo[d] = std::min(lo[d], p[d]);
+	  hi[d] = std::max(hi[d], p[d]);
+	}
+    }
+
+    void init(std::vector<point> pts, const point& lo, const point& hi,
+	      unsigned nthreads) {
+      _lo = lo;
+      _hi = hi;
+      for (int d = 0; d < D; ++d) {
+	const Real w = hi[d] - lo[d];
+	_scale[d] = w > 0 ? Real(max_cell() / w) : Real(0);
+      }
+
+      const std::size_t n = pts.size();
+      nthreads = thread_count(nthreads, n);
+      _keys.resize(n);
+      parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned) {
+	  for (std::size_t i = b; i < e; ++i)
+	    _keys[i] = key_of(pts[i]);
+	});
+
+      radix_sort(_keys, _perm, nthreads);
+      _points.resize(n);
+      parallel_for(n, nthreads, [&](std::size_t b, std::size_t e, unsigned) {
+	  for (std::size_t k = b; k < e; ++k)
+	    _points[k] = pts[_perm[k]];
+	});
+    }
+
+    point _lo, _hi;
+    // Grid cells per unit length
+    point _scale;
+    std::vector<point> _points;
+    std::vector<uint64_t> _keys;
+    std::vector<uint32_t> _perm;
+  };
+}
+#endif
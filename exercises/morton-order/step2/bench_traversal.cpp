@@ -0,0 +1,194 @@
+// Compare ways of walking over a big Morton matrix: row by row with
+// and without software prefetch, and quadrant by quadrant in Z and
+// Gray code order.
+//
+// Where the kernel lets us (Linux perf_event_open), the cache
+// counters for each run are printed too. L2 misses aren't one of the
+// generic events, so we report L1D and last level cache read misses;
+// pass -raw <hex> to also count a raw, CPU specific event (e.g.
+// 0x3f24 is L2_RQSTS.MISS on recent Intel parts).
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "matrix.hpp"
+#include "traversal.hpp"
+
+using clock_type = std::chrono::high_resolution_clock;
+
+// A group of hardware counters. Any that can't be opened read as -1.
+class counters {
+public:
+  static const int count = 4;
+
+  explicit counters(uint64_t raw) {
+#ifdef __linux__
+    const uint64_t cache_read_miss = (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    open(0, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | cache_read_miss);
+    open(1, PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | cache_read_miss);
+    open(2, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES);
+    if (raw)
+      open(3, PERF_TYPE_RAW, raw);
+    else
+      _fd[3] = -1;
+#else
+    for (auto& fd: _fd)
+      fd = -1;
+#endif
+  }
+  ~counters() {
+#ifdef __linux__
+    for (auto fd: _fd)
+      if (fd >= 0)
+	close(fd);
+#endif
+  }
+
+  void start() {
+#ifdef __linux__
+    for (auto fd: _fd)
+      if (fd >= 0) {
+	ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+	ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+      }
+#endif
+  }
+  void stop() {
+#ifdef __linux__
+    for (int i = 0; i < count; ++i) {
+      _value[i] = -1;
+      if (_fd[i] < 0)
+	continue;
+      ioctl(_fd[i], PERF_EVENT_IOC_DISABLE, 0);
+      long long v;
+      if (read(_fd[i], &v, sizeof(v)) == sizeof(v))
+	_value[i] = v;
+    }
+#else
+    for (auto& v: _value)
+      v = -1;
+#endif
+  }
+  long long value(int i) const {
+    return _value[i];
+  }
+
+private:
+#ifdef __linux__
+  void open(int i, uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    _fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+#endif
+  int _fd[count];
+  long long _value[count];
+};
+
+void print_count(long long v) {
+  if (v < 0)
+    std::printf(" %12s", "n/a");
+  else
+    std::printf(" %12lld", v);
+}
+
+template<class F>
+void run(const char* name, counters& ctr, int nrepeat, F f) {
+  double sum = 0;
+  auto begin = clock_type::now();
+  ctr.start();
+  for (int r = 0; r < nrepeat; ++r)
+    sum += f();
+  ctr.stop();
+  auto end = clock_type::now();
+  double time = std::chrono::duration<double>(end - begin).count();
+  std::printf("%-20s %10.4f", name, time / nrepeat);
+  for (int i = 0; i < counters::count; ++i)
+    print_count(ctr.value(i) < 0 ? -1 : ctr.value(i) / nrepeat);
+  // Stop the sums being optimised away
+  std::printf("   (%g)\n", sum);
+}
+
+template<class Prefetch>
+double row_sum(const morton::matrix<double>& A) {
+  double sum = 0;
+  morton::for_each_row_major<Prefetch>(A, [&sum](uint32_t, uint32_t, const double& v) {
+      sum += v;
+    });
+  return sum;
+}
+
+template<class Prefetch>
+double quad_sum(const morton::matrix<double>& A, uint32_t level, morton::quadrant_order order) {
+  double sum = 0;
+  morton::for_each_quadrant<Prefetch>(A, level, order,
+    [&sum](const double* q, uint32_t qrank, uint32_t, uint32_t) {
+      const uint64_t n = uint64_t(qrank) * qrank;
+      for (uint64_t k = 0; k < n; ++k)
+	sum += q[k];
+    });
+  return sum;
+}
+
+int main(int argc, char* argv[]) {
+  int logN = 12;
+  int nrepeat = 5;
+  uint64_t raw = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-N") == 0 && i + 1 < argc) {
+      logN = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-nrepeat") == 0 && i + 1 < argc) {
+      nrepeat = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-raw") == 0 && i + 1 < argc) {
+      raw = std::strtoull(argv[++i], nullptr, 16);
+    } else {
+      std::printf("  Traversal options:\n");
+      std::printf("  -N <int>:        exponent num, matrix is 2^num x 2^num (default: 12)\n");
+      std::printf("  -nrepeat <int>:  number of repetitions (default: 5)\n");
+      std::printf("  -raw <hex>:      also count this raw perf event\n");
+      return 1;
+    }
+  }
+  const uint32_t N = 1U << logN;
+  morton::matrix<double> A(N);
+  for (uint64_t z = 0; z < A.size(); ++z)
+    A.data()[z] = double(z % 7);
+
+  counters ctr(raw);
+  std::printf("%-20s %10s %12s %12s %12s %12s\n", "traversal", "time (s)",
+	      "L1D miss", "LLC miss", "cache miss", "raw");
+
+  using morton::prefetch;
+  using morton::no_prefetch;
+  run("rows", ctr, nrepeat, [&]() { return row_sum<no_prefetch>(A); });
+  run("rows prefetch 8", ctr, nrepeat, [&]() { return row_sum<prefetch<8>>(A); });
+  run("rows prefetch 32", ctr, nrepeat, [&]() { return row_sum<prefetch<32>>(A); });
+  run("rows prefetch 128", ctr, nrepeat, [&]() { return row_sum<prefetch<128>>(A); });
+
+  const uint32_t level = logN > 6 ? logN - 6 : 1;
+  const auto z = morton::quadrant_order::z;
+  const auto gray = morton::quadrant_order::gray;
+  run("quads z", ctr, nrepeat, [&]() { return quad_sum<no_prefetch>(A, level, z); });
+  run("quads z prefetch", ctr, nrepeat, [&]() { return quad_sum<prefetch<4>>(A, level, z); });
+  run("quads gray", ctr, nrepeat, [&]() { return quad_sum<no_prefetch>(A, level, gray); });
+  run("quads gray prefetch", ctr, nrepeat, [&]() { return quad_sum<prefetch<4>>(A, level, gray); });
+  return 0;
+}
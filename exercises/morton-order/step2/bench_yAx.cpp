@@ -0,0 +1,101 @@
+// Benchmark y^T A x on a Morton matrix against the same product on a
+// row-major array, i.e. what the Kokkos exercises compute.
+//
+// Output matches the Kokkos exercises: a summary line per layout and
+// a CSV line that can be pasted into kokkos/plot.ipynb.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "linalg.hpp"
+
+using clock_type = std::chrono::high_resolution_clock;
+
+// Row-major y^T A x, with rows split statically between threads
+double row_major_yAx(const std::vector<double>& y, const std::vector<double>& A,
+		     const std::vector<double>& x, uint32_t N, int nthreads) {
+  std::vector<double> partial(nthreads);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < nthreads; ++t) {
+    threads.emplace_back([&, t]() {
+	const uint32_t begin = uint64_t(N) * t / nthreads;
+	const uint32_t end = uint64_t(N) * (t + 1) / nthreads;
+	double sum = 0;
+	for (uint32_t j = begin; j < end; ++j) {
+	  double temp = 0;
+	  for (uint32_t i = 0; i < N; ++i)
+	    temp += A[uint64_t(j)*N + i] * x[i];
+	  sum += y[j] * temp;
+	}
+	partial[t] = sum;
+      });
+  }
+  for (auto& th: threads)
+    th.join();
+  double result = 0;
+  for (auto p: partial)
+    result += p;
+  return result;
+}
+
+template<class F>
+void run(const char* layout, int logN, int nthreads, int nrepeat, F f) {
+  const uint32_t N = 1U << logN;
+  const double solution = double(N) * double(N);
+  auto begin = clock_type::now();
+  for (int repeat = 0; repeat < nrepeat; ++repeat) {
+    double result = f();
+    if (result != solution)
+      std::printf("  Error: result( %lf ) != solution( %lf )\n", result, solution);
+  }
+  auto end = clock_type::now();
+  double time = std::chrono::duration<double>(end - begin).count();
+  double Gbytes = 1.0e-9 * double(sizeof(double) * (N + uint64_t(N) * N + N));
+  std::printf("  %s N( %d ) M( %d ) nrepeat ( %d ) problem( %g MB ) time( %g s ) bandwidth( %g GB/s )\n",
+	      layout, N, N, nrepeat, Gbytes * 1000, time, Gbytes * nrepeat / time);
+  std::printf("CSV: std::thread, %s, %d, %d, %d, %g\n",
+	      layout, nthreads, logN, logN, Gbytes * nrepeat / time);
+}
+
+int main(int argc, char* argv[]) {
+  int logN = 11;
+  int nrepeat = 100;
+  int nthreads = morton::default_threads();
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-N") == 0 && i + 1 < argc) {
+      logN = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-nrepeat") == 0 && i + 1 < argc) {
+      nrepeat = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      nthreads = std::atoi(argv[++i]);
+    } else {
+      std::printf("  y^T*A*x Options:\n");
+      std::printf("  -N <int>:        exponent num, matrix is 2^num x 2^num (default: 11)\n");
+      std::printf("  -nrepeat <int>:  number of repetitions (default: 100)\n");
+      std::printf("  -threads <int>:  number of threads (default: all cores)\n");
+      return 1;
+    }
+  }
+  const uint32_t N = 1U << logN;
+
+  std::vector<double> x(N, 1.0), y(N, 1.0);
+
+  {
+    std::vector<double> A(uint64_t(N) * N, 1.0);
+    run("LayoutRight", logN, nthreads, nrepeat,
+	[&]() { return row_major_yAx(y, A, x, N, nthreads); });
+  }
+  {
+    morton::matrix<double> A(N);
+    std::fill(A.data(), A.data() + A.size(), 1.0);
+    run("Morton", logN, nthreads, nrepeat,
+	[&]() { return morton::yAx(y, A, x, nthreads); });
+  }
+  return 0;
+}
@@ -0,0 +1,128 @@
+#ifndef MORTON_CHECKPOINT_HPP
+#define MORTON_CHECKPOINT_HPP
+
+#include <cstring>
+#include <istream>
+#include <ostream>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include "matrix.hpp"
+#include "tracked_matrix.hpp"
+
+// Incremental checkpoints of Morton matrices.
+//
+// Since each quadrant is a contiguous chunk of memory, the dirty
+// quadrants of a tracked_matrix can be written out as a few byte
+// ranges.
+//
+// A checkpoint is a header followed by a list of runs, each being
+// (byte offset, byte length, raw bytes). A full checkpoint is just
+// one run covering everything. To restore, read the last full
+// checkpoint and then each incremental one in order.
+namespace morton {
+
+  // Byte ranges (offset, length) covering the dirty quadrants, with
+  // adjacent quadrants merged
+  template<class T>
+  std::vector<std::pair<uint64_t, uint64_t>> dirty_runs(const tracked_matrix<T>& m) {
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    const uint64_t qbytes = m.quadrant_size() * sizeof(T);
+    for (auto q: m.dirty_quadrants()) {
+      if (!runs.empty() && runs.back().first + runs.back().second == q * qbytes)
+	runs.back().second += qbytes;
+      else
+	runs.emplace_back(q * qbytes, qbytes);
+    }
+    return runs;
+  }
+
+  namespace detail {
+    const char checkpoint_magic[8] = {'M', 'O', 'R', 'T', 'C', 'K', 'P', '1'};
+
+    template<class V>
+    void write_pod(std::ostream& os, const V& v) {
+      os.write(reinterpret_cast<const char*>(&v), sizeof(V));
+    }
+    template<class V>
+    bool read_pod(std::istream& is, V& v) {
+      return bool(is.read(reinterpret_cast<char*>(&v), sizeof(V)));
+    }
+  }
+
+  namespace detail {
+    template<class T>
+    uint64_t write_runs(std::ostream& os, const matrix<T>& m,
+			const std::vector<std::pair<uint64_t, uint64_t>>& runs) {
+      static_assert(std::is_trivially_copyable<T>::value,
+		    "Checkpoints store the raw bytes of the elements");
+      os.write(checkpoint_magic, sizeof(checkpoint_magic));
+      write_pod(os, m.rank());
+      write_pod(os, uint32_t(sizeof(T)));
+      write_pod(os, uint64_t(runs.size()));
+
+      const char* bytes = reinterpret_cast<const char*>(m.data());
+      uint64_t total = 0;
+      for (auto& r: runs) {
+	write_pod(os, r.first);
+	write_pod(os, r.second);
+	os.write(bytes + r.first, r.second);
+	total += r.second;
+      }
+      return total;
+    }
+  }
+
+  // Write a full checkpoint of the matrix. Returns the number of data
+  // bytes written.
+  template<class T>
+  uint64_t write_checkpoint(std::ostream& os, const matrix<T>& m) {
+    std::vector<std::pair<uint64_t, uint64_t>> runs;
+    if (m.size())
+      runs.emplace_back(0, m.size() * sizeof(T));
+    return detail::write_runs(os, m, runs);
+  }
+
+  // Write the dirty parts of the matrix and mark it clean. Returns the
+  // number of data bytes written.
+  template<class T>
+  uint64_t write_checkpoint(std::ostream& os, tracked_matrix<T>& m) {
+    const auto total = detail::write_runs(os, m.base(), dirty_runs(m));
+    m.clear_dirty();
+    return total;
+  }
+
+  // Apply a checkpoint to a matrix of the right rank. Returns false if
+  // the stream doesn't contain a matching checkpoint.
+  template<class T>
+  bool read_checkpoint(std::istream& is, matrix<T>& m) {
+    static_assert(std::is_trivially_copyable<T>::value,
+		  "Checkpoints store the raw bytes of the elements");
+    char magic[sizeof(detail::checkpoint_magic)];
+    if (!is.read(magic, sizeof(magic)) ||
+	std::memcmp(magic, detail::checkpoint_magic, sizeof(magic)) != 0)
+      return false;
+
+    uint32_t rank, elem_size;
+    uint64_t nruns;
+    if (!detail::read_pod(is, rank) || !detail::read_pod(is, elem_size) ||
+	!detail::read_pod(is, nruns))
+      return false;
+    if (rank != m.rank() || elem_size != sizeof(T))
+      return false;
+
+    const uint64_t total = m.size() * sizeof(T);
+    char* bytes = reinterpret_cast<char*>(m.data());
+    for (uint64_t i = 0; i < nruns; ++i) {
+      uint64_t offset, length;
+      if (!detail::read_pod(is, offset) || !detail::read_pod(is, length))
+	return false;
+      if (offset > total || length > total - offset)
+	return false;
+      if (!is.read(bytes + offset, length))
+	return false;
+    }
+    return true;
+  }
+}
+#endif
@@ -0,0 +1,414 @@
+#ifndef MORTON_COMPRESSED_MATRIX_HPP
+#define MORTON_COMPRESSED_MATRIX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+#include "bits.hpp"
+#include "matrix.hpp"
+
+namespace morton {
+  namespace detail {
+    // Unsigned integer with the same size as a float or double
+    template<class T> struct float_bits;
+    template<> struct float_bits<float> { using type = uint32_t; };
+    template<> struct float_bits<double> { using type = uint64_t; };
+
+    // Number of significant bits
+    inline unsigned bit_width(uint32_t x) {
+      return x ? 32 - __builtin_clz(x) : 0;
+    }
+    inline unsigned bit_width(uint64_t x) {
+      return x ? 64 - __builtin_clzll(x) : 0;
+    }
+
+    // Map the bits of a float to an unsigned integer that sorts the
+    // same way, so nearby values are nearby integers
+    template<class U>
+    U ordered(U bits) {
+      const U sign = U(1) << (8*sizeof(U) - 1);
+      return (bits & sign) ? ~bits : bits | sign;
+    }
+    template<class U>
+    U unordered(U x) {
+      const U sign = U(1) << (8*sizeof(U) - 1);
+      return (x & sign) ? x & ~sign : ~x;
+    }
+
+    // Write or read values of up to 64 bits to a byte vector, least
+    // significant bit first
+    class bit_writer {
+    public:
+      explicit bit_writer(std::vector<uint8_t>& out) : _out(out), _acc(0), _n(0) {
+      }
+      void put(uint64_t x, unsigned bits) {
+	if (bits > 32) {
+	  put(x & 0xffffffffU, 32);
+	  x >>= 32;
+	  bits -= 32;
+	}
+	_acc |= x << _n;
+	_n += bits;
+	while (_n >= 8) {
+	  _out.push_back(uint8_t(_acc));
+	  _acc >>= 8;
+	  _n -= 8;
+	}
+      }
+      void finish() {
+	if (_n)
+	  _out.push_back(uint8_t(_acc));
+	_acc = 0;
+	_n = 0;
+      }
+    private:
+      std::vector<uint8_t>& _out;
+      uint64_t _acc;
+      unsigned _n;
+    };
+
+    class bit_reader {
+    public:
+      explicit bit_reader(const std::vector<uint8_t>& in) : _p(in.data()), _acc(0), _n(0) {
+      }
+      uint64_t get(unsigned bits) {
+	if (bits > 32) {
+	  const uint64_t lo = get(32);
+	  return lo | get(bits - 32) << 32;
+	}
+	while (_n < bits) {
+	  _acc |= uint64_t(*_p++) << _n;
+	  _n += 8;
+	}
+	const uint64_t x = bits ? _acc & (~uint64_t(0) >> (64 - bits)) : 0;
+	_acc >>= bits;
+	_n -= bits;
+	return x;
+      }
+      const uint8_t* position() const {
+	return _p;
+      }
+    private:
+      const uint8_t* _p;
+      uint64_t _acc;
+      unsigned _n;
+    };
+
+    // Codec settings for each type. Order of the predictor: higher
+    // orders cancel more of the smooth part of the field but amplify
+    // the rounding noise, and floats have more of that.
+    template<class T> struct codec_traits;
+    template<> struct codec_traits<float> {
+      static const int order = 2;
+      // Bits to store a width of 0 to 32
+      static const unsigned header_bits = 6;
+    };
+    template<> struct codec_traits<double> {
+      static const int order = 3;
+      static const unsigned header_bits = 7;
+    };
+
+    // Predict element (i, j) of a Morton ordered tile from the ones
+    // before it, by extrapolating a polynomial of degree order - 1 in
+    // each direction (the generalised Lorenzo predictor): the mixed
+    // difference Delta_i^a Delta_j^b is taken to be zero. All the
+    // points used have smaller Morton codes, so have already been
+    // decoded. Near the low edges of the tile a and b are reduced.
+    //
+    // Only subtractions are used, so the compiler can't fuse anything
+    // into an FMA differently in the compressor and decompressor, which
+    // would break the round trip. (Don't build with -ffast-math.)
+    template<class T>
+    T predict(const T* tile, uint32_t i, uint32_t j) {
+      const int K = codec_traits<T>::order;
+      const int a = std::min<uint32_t>(i, K), b = std::min<uint32_t>(j, K);
+      // Rows of the difference table, with the unknown (i, j) as zero
+      T row[K + 1];
+      for (int p = 0; p <= a; ++p) {
+	T x[K + 1];
+	for (int q = 0; q <= b; ++q)
+	  x[q] = (p == 0 && q == 0) ? T(0) : tile[encode(i - p, j - q)];
+	for (int level = 0; level < b; ++level)
+	  for (int q = 0; q < b - level; ++q)
+	    x[q] = x[q] - x[q + 1];
+	row[p] = x[0];
+      }
+      for (int level = 0; level < a; ++level)
+	for (int p = 0; p < a - level; ++p)
+	  row[p] = row[p] - row[p + 1];
+      // Delta_i^a Delta_j^b f = f(i, j) + row[0] = 0
+      return -row[0];
+    }
+
+    // Lossless compression of a Morton ordered tile of n floating point
+    // numbers (n a power of 4).
+    //
+    // Each value is predicted from its neighbours with predict() and
+    // the difference between the actual and predicted values, as
+    // ordered integers, is zigzag coded so that small differences of
+    // either sign have only a few significant bits. In a smooth field
+    // the prediction matches the sign, exponent and much of the
+    // mantissa. Each group of four values (a 2x2 quad in Z order)
+    // stores the width in bits of its largest difference, then the
+    // four differences at that width.
+    template<class T>
+    void compress(const T* src, std::size_t n, std::vector<uint8_t>& out) {
+      using U = typename float_bits<T>::type;
+      using S = typename std::make_signed<U>::type;
+      const unsigned W = 8 * sizeof(U);
+      out.clear();
+      out.reserve(n * sizeof(T) / 2);
+      bit_writer bits(out);
+      U diff[4];
+      for (std::size_t z = 0; z < n; z += 4) {
+	const unsigned group = std::min<std::size_t>(4, n - z);
+	unsigned width = 0;
+	for (unsigned k = 0; k < group; ++k) {
+	  uint32_t i, j;
+	  decode(z + k, i, j);
+	  const T guess = predict(src, i, j);
+	  U actual, predicted;
+	  std::memcpy(&actual, src + z + k, sizeof(U));
+	  std::memcpy(&predicted, &guess, sizeof(U));
+	  const S d = S(ordered(actual) - ordered(predicted));
+	  diff[k] = U(d) << 1 ^ U(d >> (W - 1));
+	  width = std::max(width, bit_width(diff[k]));
+	}
+	bits.put(width, codec_traits<T>::header_bits);
+	for (unsigned k = 0; k < group; ++k)
+	  bits.put(diff[k], width);
+      }
+      bits.finish();
+    }
+
+    template<class T>
+    void decompress(const std::vector<uint8_t>& in, std::size_t n, T* dst) {
+      using U = typename float_bits<T>::type;
+      bit_reader bits(in);
+      for (std::size_t z = 0; z < n; z += 4) {
+	const unsigned group = std::min<std::size_t>(4, n - z);
+	const unsigned width = bits.get(codec_traits<T>::header_bits);
+	for (unsigned k = 0; k < group; ++k) {
+	  const U zz = bits.get(width);
+	  const U d = zz >> 1 ^ (U(0) - (zz & 1));
+	  uint32_t i, j;
+	  decode(z + k, i, j);
+	  const T guess = predict(dst, i, j);
+	  U predicted;
+	  std::memcpy(&predicted, &guess, sizeof(U));
+	  const U actual = unordered(U(ordered(predicted) + d));
+	  std::memcpy(dst + z + k, &actual, sizeof(U));
+	}
+      }
+      assert(bits.position() == in.data() + in.size());
+    }
+  }
+
+  // 2D square Morton order matrix of float or double, held
+  // compressed.
+  //
+  // The data is split into tiles (quadrants of tile_rank x
+  // tile_rank elements) that are stored compressed, see
+  // detail::compress. Z order keeps neighbouring values next to each
+  // other so smooth fields compress well: typically 2-3x for double
+  // and 3-5x for float.
+  //
+  // To work on a tile it is decompressed into a small cache of hot
+  // tiles. When the cache is full the least recently used tile is
+  // dropped, being compressed again first if it was written to.
+  //
+  // NB:
+  //
+  //  - element access goes through the cache so is much slower than
+  //    a normal matrix; get a tile pointer for loops
+  //
+  //  - even const access changes the cache, so a compressed_matrix
+  //    must not be used from several threads at once
+  //
+  //  - tile pointers are only valid until the next access that has
+  //    to load a different tile
+  template<class T>
+  class compressed_matrix {
+    static_assert(std::is_same<T, float>::value || std::is_same<T, double>::value,
+		  "compressed_matrix only supports float and double");
+  public:
+    compressed_matrix() : _rank(0), _shift(0), _clock(0), _misses(0) {
+    }
+
+    // All elements start at zero. The tile rank is reduced if it is
+    // bigger than the matrix.
+    compressed_matrix(uint32_t r, uint32_t tile_rank = 32, std::size_t cache_tiles = 16)
+      : _rank(r), _shift(0), _clock(0), _misses(0) {
+      assert((r & (r-1)) == 0);
+      assert((tile_rank & (tile_rank-1)) == 0 && tile_rank > 0);
+      assert(cache_tiles > 0);
+      if (tile_rank > r)
+	tile_rank = r ? r : 1;
+      while ((1U << _shift) < tile_rank)
+	++_shift;
+      _shift *= 2;
+      const std::size_t ntiles = r ? size() >> _shift : 0;
+      std::vector<T> zero(tile_size(), T(0));
+      std::vector<uint8_t> packed;
+      detail::compress(zero.data(), zero.size(), packed);
+      _tiles.assign(ntiles, packed);
+      _slot_of.assign(ntiles, -1);
+      _cache.resize(std::min(cache_tiles, ntiles));
+    }
+
+    // Build from a normal matrix
+    static compressed_matrix from_matrix(const matrix<T>& m, uint32_t tile_rank = 32,
+					 std::size_t cache_tiles = 16) {
+      compressed_matrix ans(m.rank(), tile_rank, cache_tiles);
+      for (std::size_t t = 0; t < ans._tiles.size(); ++t)
+	detail::compress(m.data() + t * ans.tile_size(), ans.tile_size(), ans._tiles[t]);
+      return ans;
+    }
+
+    // Decompress everything into a normal matrix
+    matrix<T> to_matrix() const {
+      matrix<T> ans(_rank);
+      for (std::size_t t = 0; t < _tiles.size(); ++t)
+	std::memcpy(ans.data() + t * tile_size(), tile_data(t), tile_size() * sizeof(T));
+      return ans;
+    }
+
+    compressed_matrix(const compressed_matrix& other) = delete;
+    compressed_matrix& operator=(const compressed_matrix& other) = delete;
+    compressed_matrix(compressed_matrix&& other) noexcept = default;
+    compressed_matrix& operator=(compressed_matrix&& other) noexcept = default;
+    ~compressed_matrix() = default;
+
+    // Create a new matrix with the same contents and an empty cache
+    compressed_matrix duplicate() const {
+      flush();
+      compressed_matrix ans;
+      ans._rank = _rank;
+      ans._shift = _shift;
+      ans._tiles = _tiles;
+      ans._slot_of.assign(_tiles.size(), -1);
+      ans._cache.resize(_cache.size());
+      return ans;
+    }
+
+    uint32_t rank() const {
+      return _rank;
+    }
+    uint64_t size() const {
+      return uint64_t(_rank) * uint64_t(_rank);
+    }
+
+    // Number of tiles and elements in each
+    std::size_t tile_count() const {
+      return _tiles.size();
+    }
+    uint64_t tile_size() const {
+      return uint64_t(1) << _shift;
+    }
+
+    // Bytes used by the compressed tiles (not counting the cache).
+    // Tiles in the cache that have been written to are only counted
+    // correctly after flush().
+    std::size_t compressed_bytes() const {
+      std::size_t ans = 0;
+      for (auto& t: _tiles)
+	ans += t.size();
+      return ans;
+    }
+    // Uncompressed size / compressed size
+    double ratio() const {
+      return double(size() * sizeof(T)) / double(compressed_bytes());
+    }
+
+    // Number of tiles decompressed so far, for checking how well the
+    // cache is working
+    uint64_t cache_misses() const {
+      return _misses;
+    }
+
+    // Decompressed data of a tile, in Morton order. The mutable
+    // version marks the tile as changed.
+    const T* tile_data(std::size_t t) const {
+      return load(t).data.data();
+    }
+    T* tile_data(std::size_t t) {
+      auto& s = load(t);
+      s.dirty = true;
+      return s.data.data();
+    }
+
+    // Element access. Unlike matrix, this returns by value as the
+    // element may not stay in the cache.
+    T operator()(uint32_t i, uint32_t j) const {
+      auto z = encode(i, j);
+      return tile_data(z >> _shift)[z & (tile_size() - 1)];
+    }
+    void set(uint32_t i, uint32_t j, T value) {
+      auto z = encode(i, j);
+      tile_data(z >> _shift)[z & (tile_size() - 1)] = value;
+    }
+
+    // Compress any changed tiles in the cache
+    void flush() const {
+      for (auto& s: _cache)
+	if (s.tile >= 0 && s.dirty) {
+	  detail::compress(s.data.data(), tile_size(), _tiles[s.tile]);
+	  s.dirty = false;
+	}
+    }
+
+  private:
+    struct slot {
+      long tile = -1;
+      bool dirty = false;
+      uint64_t last_use = 0;
+      std::vector<T> data;
+    };
+
+    // Get tile t into the cache
+    slot& load(std::size_t t) const {
+      ++_clock;
+      if (_slot_of[t] >= 0) {
+	auto& s = _cache[_slot_of[t]];
+	s.last_use = _clock;
+	return s;
+      }
+
+      // The cache is small, so just look through it for the victim
+      std::size_t victim = 0;
+      for (std::size_t k = 1; k < _cache.size(); ++k)
+	if (_cache[k].last_use < _cache[victim].last_use)
+	  victim = k;
+      auto& s = _cache[victim];
+      if (s.tile >= 0) {
+	if (s.dirty)
+	  detail::compress(s.data.data(), tile_size(), _tiles[s.tile]);
+	_slot_of[s.tile] = -1;
+      }
+
+      s.data.resize(tile_size());
+      detail::decompress(_tiles[t], tile_size(), s.data.data());
+      s.tile = t;
+      s.dirty = false;
+      s.last_use = _clock;
+      _slot_of[t] = victim;
+      ++_misses;
+      return s;
+    }
+
+    uint32_t _rank;
+    // 2*log2(tile rank) - number of Morton bits within a tile
+    uint32_t _shift;
+    // Compressed tiles, in Morton order
+    mutable std::vector<std::vector<uint8_t>> _tiles;
+    // Cache of decompressed tiles, and the slot each tile is in (or -1)
+    mutable std::vector<slot> _cache;
+    mutable std::vector<long> _slot_of;
+    mutable uint64_t _clock;
+    mutable uint64_t _misses;
+  };
+}
+#endif
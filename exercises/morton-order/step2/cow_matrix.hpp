@@ -0,0 +1,152 @@
+#ifndef MORTON_COW_MATRIX_HPP
+#define MORTON_COW_MATRIX_HPP
+
+#include <cassert>
+#include <memory>
+#include <vector>
+#include "bits.hpp"
+#include "matrix.hpp"
+#include "stream_copy.hpp"
+
+namespace morton {
+  // 2D square Morton order matrix with copy-on-write quadrants.
+  //
+  // The data is split into the 4^level quadrants at the chosen level
+  // of the quadtree, each held by a shared_ptr. duplicate() just
+  // copies the pointers, so the duplicates share all their storage.
+  // The first mutable access to a shared quadrant gives the matrix its
+  // own copy of that quadrant only.
+  //
+  // This suits checkpoint/rollback, where we take a copy of a big
+  // matrix and then only change a few parts of it.
+  //
+  // NB:
+  //
+  //  - mutable access to an element can allocate and copy a whole
+  //    quadrant, so get a quadrant pointer for tight loops
+  //
+  //  - writing to different duplicates of one matrix from different
+  //    threads is fine, but two threads must not make the first write
+  //    to the same quadrant of the same matrix at once
+  template<class T>
+  class cow_matrix {
+  public:
+    cow_matrix() : _rank(0), _shift(0) {
+    }
+
+    cow_matrix(uint32_t r, uint32_t level = 2) : _rank(r), _shift(0) {
+      assert((r & (r-1)) == 0);
+      // Can't have quadrants smaller than a single element
+      while (level > 0 && (r >> level) == 0)
+	--level;
+      const uint32_t qrank = r >> level;
+      while ((1U << _shift) < qrank)
+	++_shift;
+      _shift *= 2;
+      _quads.resize(uint64_t(1) << (2*level));
+      for (auto& q: _quads)
+	q = allocate();
+    }
+
+    // Build from (a copy of) a normal matrix
+    static cow_matrix from_matrix(const matrix<T>& m, uint32_t level = 2) {
+      cow_matrix ans(m.rank(), level);
+      for (std::size_t q = 0; q < ans._quads.size(); ++q)
+	stream_copy(m.data() + q * ans.quadrant_size(), ans.quadrant_size(),
+		    ans._quads[q].get());
+      return ans;
+    }
+
+    // Copy out into a normal matrix
+    matrix<T> to_matrix() const {
+      matrix<T> ans(_rank);
+      for (std::size_t q = 0; q < _quads.size(); ++q)
+	stream_copy(_quads[q].get(), quadrant_size(),
+		    ans.data() + q * quadrant_size());
+      return ans;
+    }
+
+    cow_matrix(const cow_matrix& other) = delete;
+    cow_matrix& operator=(const cow_matrix& other) = delete;
+    cow_matrix(cow_matrix&& other) noexcept = default;
+    cow_matrix& operator=(cow_matrix&& other) noexcept = default;
+    ~cow_matrix() = default;
+
+    // Create a new matrix sharing all quadrants with this one
+    cow_matrix duplicate() const {
+      cow_matrix ans;
+      ans._rank = _rank;
+      ans._shift = _shift;
+      ans._quads = _quads;
+      return ans;
+    }
+
+    uint32_t rank() const {
+      return _rank;
+    }
+    uint64_t size() const {
+      return uint64_t(_rank) * uint64_t(_rank);
+    }
+
+    // Number of quadrants and elements in each
+    std::size_t quadrant_count() const {
+      return _quads.size();
+    }
+    uint64_t quadrant_size() const {
+      return uint64_t(1) << _shift;
+    }
+
+    // Is quadrant q shared with another matrix?
+    bool is_shared(std::size_t q) const {
+      return _quads[q].use_count() > 1;
+    }
+    std::size_t shared_count() const {
+      std::size_t n = 0;
+      for (std::size_t q = 0; q < _quads.size(); ++q)
+	n += is_shared(q);
+      return n;
+    }
+
+    // Raw data of a quadrant, in Morton order. The mutable version
+    // unshares it first.
+    const T* quadrant_data(std::size_t q) const {
+      return _quads[q].get();
+    }
+    T* quadrant_data(std::size_t q) {
+      unshare(q);
+      return _quads[q].get();
+    }
+
+    // Const element access
+    const T& operator()(uint32_t i, uint32_t j) const {
+      auto z = encode(i, j);
+      return _quads[z >> _shift].get()[z & (quadrant_size() - 1)];
+    }
+
+    // Mutable element access
+    T& operator()(uint32_t i, uint32_t j) {
+      auto z = encode(i, j);
+      return quadrant_data(z >> _shift)[z & (quadrant_size() - 1)];
+    }
+
+  private:
+    std::shared_ptr<T> allocate() const {
+      return std::shared_ptr<T>(new T[quadrant_size()], std::default_delete<T[]>());
+    }
+
+    void unshare(std::size_t q) {
+      if (!is_shared(q))
+	return;
+      auto mine = allocate();
+      stream_copy(_quads[q].get(), quadrant_size(), mine.get());
+      _quads[q] = std::move(mine);
+    }
+
+    uint32_t _rank;
+    // 2*log2(quadrant rank) - number of Morton bits within a quadrant
+    uint32_t _shift;
+    // Quadrant storage, in Morton order
+    std::vector<std::shared_ptr<T>> _quads;
+  };
+}
+#endif
@@ -0,0 +1,546 @@
+#ifndef MORTON_LINALG_HPP
+#define MORTON_LINALG_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <future>
+#include <thread>
+#include <vector>
+#include "bits.hpp"
+#include "matrix.hpp"
+
+// Recursive dense linear algebra on Morton ordered matrices.
+//
+// The point of the Morton layout is that every aligned quadrant of
+// the matrix is itself a contiguous Morton ordered matrix. So we can
+// recurse on quadrants until they fit in cache and never have to
+// copy or repack anything on the way down.
+//
+// Quadrant tasks are run in parallel with std::async. The "par"
+// arguments are the number of threads a call may use; it is divided
+// between the sub-tasks at each level so we don't oversubscribe (see
+// detail::run_tasks).
+namespace morton {
+
+  // A square, power-of-2 sized, aligned sub-block of a Morton
+  // matrix. Because it's aligned, its elements are contiguous and in
+  // Morton order relative to its own origin.
+  template<class T>
+  struct block {
+    T* data;
+    uint32_t rank;
+
+    T& operator()(uint32_t i, uint32_t j) const {
+      return data[encode(i, j)];
+    }
+
+    // Get quadrant (qi, qj), qi being the row half and qj the column
+    // half. The row bit is the lower one in the Morton code so the
+    // quadrants are stored (0,0), (1,0), (0,1), (1,1).
+    block quad(uint32_t qi, uint32_t qj) const {
+      const uint64_t h = rank / 2;
+      return block{data + (qi + 2*qj) * h * h, rank / 2};
+    }
+  };
+
+  template<class T>
+  block<T> make_block(matrix<T>& m) {
+    return block<T>{m.data(), m.rank()};
+  }
+  template<class T>
+  block<const T> make_block(const matrix<T>& m) {
+    return block<const T>{m.data(), m.rank()};
+  }
+
+  // Default number of threads for the top level calls
+  inline int default_threads() {
+    auto n = std::thread::hardware_concurrency();
+    return n ? n : 1;
+  }
+
+  namespace detail {
+    // Below this rank we stop recursing and use simple loops
+    const uint32_t leaf_rank = 32;
+
+    // Run f(t, child_par) for t in [0, ntasks), in parallel if par > 1.
+    //
+    // At most min(par, ntasks) workers run at once (the calling thread
+    // being one of them), each taking the next task in turn until
+    // there are none left. The workers' child_par shares add up to
+    // par, so however deep the recursion goes no more than par tasks
+    // run at the same time.
+    template<class F>
+    void run_tasks(int par, int ntasks, F f) {
+      if (ntasks <= 0)
+	return;
+      if (par <= 1 || ntasks == 1) {
+	for (int t = 0; t < ntasks; ++t)
+	  f(t, std::max(par, 1));
+	return;
+      }
+      const int nworkers = std::min(par, ntasks);
+      std::atomic<int> next(0);
+      auto work = [&](int w) {
+	const int child = par / nworkers + (w < par % nworkers);
+	for (int t = next++; t < ntasks; t = next++)
+	  f(t, child);
+      };
+      std::vector<std::future<void>> futures;
+      for (int w = 1; w < nworkers; ++w)
+	futures.push_back(std::async(std::launch::async, work, w));
+      work(0);
+      for (auto& fut: futures)
+	fut.get();
+    }
+
+    // Copy a leaf block to/from a row-major buffer
+    template<class T>
+    void to_rows(const block<T>& b, T* buf) {
+      const uint64_t n = uint64_t(b.rank) * b.rank;
+      uint32_t i, j;
+      for (uint64_t z = 0; z < n; ++z) {
+	decode(z, i, j);
+	buf[i*b.rank + j] = b.data[z];
+      }
+    }
+    template<class T>
+    void from_rows(const T* buf, const block<T>& b) {
+      const uint64_t n = uint64_t(b.rank) * b.rank;
+      uint32_t i, j;
+      for (uint64_t z = 0; z < n; ++z) {
+	decode(z, i, j);
+	b.data[z] = buf[i*b.rank + j];
+      }
+    }
+
+    // C += s * A * op(B) on leaf blocks, with op(B) = B or B^T
+    template<class T>
+    void leaf_multiply(block<T> C, block<T> A, block<T> B, T s, bool transB) {
+      const uint32_t n = C.rank;
+      T a[leaf_rank*leaf_rank], b[leaf_rank*leaf_rank], c[leaf_rank*leaf_rank];
+      to_rows(A, a);
+      to_rows(B, b);
+      to_rows(C, c);
+      if (transB) {
+	for (uint32_t i = 0; i < n; ++i)
+	  for (uint32_t j = 0; j < n; ++j) {
+	    T sum = 0;
+	    for (uint32_t k = 0; k < n; ++k)
+	      sum += a[i*n + k] * b[j*n + k];
+	    c[i*n + j] += s * sum;
+	  }
+      } else {
+	for (uint32_t i = 0; i < n; ++i)
+	  for (uint32_t k = 0; k < n; ++k) {
+	    const T aik = s * a[i*n + k];
+	    for (uint32_t j = 0; j < n; ++j)
+	      c[i*n + j] += aik * b[k*n + j];
+	  }
+      }
+      from_rows(c, C);
+    }
+  }
+
+  // C += s * A * op(B), op(B) = B or B^T. All blocks the same rank.
+  //
+  // Each half of the product is split into four independent quadrant
+  // updates which are run as parallel tasks.
+  template<class T>
+  void multiply_add(block<T> C, block<T> A, block<T> B, T s = 1,
+		    bool transB = false, int par = 1) {
+    assert(C.rank == A.rank && A.rank == B.rank);
+    if (C.rank <= detail::leaf_rank) {
+      detail::leaf_multiply(C, A, B, s, transB);
+      return;
+    }
+    for (uint32_t k = 0; k < 2; ++k) {
+      detail::run_tasks(par, 4, [=](int t, int child) {
+	  const uint32_t i = t & 1, j = t >> 1;
+	  auto b = transB ? B.quad(j, k) : B.quad(k, j);
+	  multiply_add(C.quad(i, j), A.quad(i, k), b, s, transB, child);
+	});
+    }
+  }
+
+  // Return A * B
+  template<class T>
+  matrix<T> multiply(const matrix<T>& A, const matrix<T>& B,
+		     int par = default_threads()) {
+    assert(A.rank() == B.rank());
+    matrix<T> C(A.rank());
+    std::fill(C.data(), C.data() + C.size(), T(0));
+    // The blocks are only read from for A and B
+    auto a = block<T>{const_cast<T*>(A.data()), A.rank()};
+    auto b = block<T>{const_cast<T*>(B.data()), B.rank()};
+    multiply_add(make_block(C), a, b, T(1), false, par);
+    return C;
+  }
+
+  namespace detail {
+    // Below this rank the matrix-vector kernels stop recursing
+    const uint32_t mv_leaf_rank = 64;
+
+    // y[0:4] += A x[0:4] for a 4x4 Morton ordered block. Rows i and
+    // i+1 are adjacent in memory, so each column gives a 2-wide
+    // update to each pair of rows, which the compiler can vectorise.
+    template<class T>
+    inline void micro_gemv(const T* a, const T* x, T* y) {
+      T y0 = y[0], y1 = y[1], y2 = y[2], y3 = y[3];
+      for (int c = 0; c < 4; ++c) {
+	const int base = (c & 1) * 2 + (c >> 1) * 8;
+	y0 += a[base] * x[c];
+	y1 += a[base + 1] * x[c];
+	y2 += a[base + 4] * x[c];
+	y3 += a[base + 5] * x[c];
+      }
+      y[0] = y0; y[1] = y1; y[2] = y2; y[3] = y3;
+    }
+
+    // y += A x for a leaf block of rank n, working in 4x4 tiles
+    template<class T>
+    void leaf_gemv(const T* a, uint32_t n, const T* x, T* y) {
+      uint32_t i, j;
+      if (n < 4) {
+	for (uint64_t z = 0; z < uint64_t(n) * n; ++z) {
+	  decode(z, i, j);
+	  y[i] += a[z] * x[j];
+	}
+	return;
+      }
+      const uint64_t ntiles = uint64_t(n) * n / 16;
+      for (uint64_t t = 0; t < ntiles; ++t) {
+	decode(t, i, j);
+	micro_gemv(a + 16*t, x + 4*j, y + 4*i);
+      }
+    }
+  }
+
+  // y += A x, where x and y point to the slices of the vectors
+  // matching the block's columns and rows. Each leaf touches just
+  // mv_leaf_rank elements of x and y. The row halves write to
+  // different parts of y so run in parallel with no synchronisation.
+  template<class T>
+  void gemv_add(block<const T> A, const T* x, T* y, int par = 1) {
+    if (A.rank <= detail::mv_leaf_rank) {
+      detail::leaf_gemv(A.data, A.rank, x, y);
+      return;
+    }
+    const uint32_t h = A.rank / 2;
+    detail::run_tasks(par, 2, [=](int i, int child) {
+	gemv_add(A.quad(i, 0), x, y + i*h, child);
+	gemv_add(A.quad(i, 1), x + h, y + i*h, child);
+      });
+  }
+
+  // Return A x
+  template<class T>
+  std::vector<T> gemv(const matrix<T>& A, const std::vector<T>& x,
+		      int par = default_threads()) {
+    assert(x.size() == A.rank());
+    std::vector<T> y(A.rank(), T(0));
+    gemv_add(make_block(A), x.data(), y.data(), par);
+    return y;
+  }
+
+  // Compute y^T A x for a block and the matching slices of x and y.
+  //
+  // The four quadrants are independent tasks, and their partial sums
+  // are combined in a fixed order on the way back up the recursion,
+  // so there are no atomics and the result doesn't depend on the
+  // number of threads.
+  template<class T>
+  T yAx(const T* y, block<const T> A, const T* x, int par = 1) {
+    if (A.rank <= detail::mv_leaf_rank) {
+      T Ax[detail::mv_leaf_rank] = {};
+      detail::leaf_gemv(A.data, A.rank, x, Ax);
+      T sum = 0;
+      for (uint32_t i = 0; i < A.rank; ++i)
+	sum += y[i] * Ax[i];
+      return sum;
+    }
+    const uint32_t h = A.rank / 2;
+    T part[4];
+    detail::run_tasks(par, 4, [&](int t, int child) {
+	const uint32_t i = t & 1, j = t >> 1;
+	part[t] = yAx(y + i*h, A.quad(i, j), x + j*h, child);
+      });
+    return (part[0] + part[1]) + (part[2] + part[3]);
+  }
+
+  template<class T>
+  T yAx(const std::vector<T>& y, const matrix<T>& A, const std::vector<T>& x,
+	int par = default_threads()) {
+    assert(x.size() == A.rank() && y.size() == A.rank());
+    return yAx(y.data(), make_block(A), x.data(), par);
+  }
+
+  // Solve L X = B in place (B <- L^-1 B) where L is unit lower
+  // triangular. Column halves of B are independent.
+  template<class T>
+  void trsm_lower_unit(block<T> L, block<T> B, int par = 1) {
+    const uint32_t n = B.rank;
+    if (n <= detail::leaf_rank) {
+      for (uint32_t j = 0; j < n; ++j)
+	for (uint32_t k = 0; k < n; ++k) {
+	  const T bkj = B(k, j);
+	  for (uint32_t i = k + 1; i < n; ++i)
+	    B(i, j) -= L(i, k) * bkj;
+	}
+      return;
+    }
+    detail::run_tasks(par, 2, [=](int j, int child) {
+	trsm_lower_unit(L.quad(0, 0), B.quad(0, j), child);
+	multiply_add(B.quad(1, j), L.quad(1, 0), B.quad(0, j), T(-1), false, child);
+	trsm_lower_unit(L.quad(1, 1), B.quad(1, j), child);
+      });
+  }
+
+  // Solve X L^T = B in place (B <- B L^-T) where L is lower
+  // triangular. Row halves of B are independent.
+  template<class T>
+  void trsm_right_lower_trans(block<T> L, block<T> B, int par = 1) {
+    const uint32_t n = B.rank;
+    if (n <= detail::leaf_rank) {
+      for (uint32_t i = 0; i < n; ++i)
+	for (uint32_t j = 0; j < n; ++j) {
+	  T sum = B(i, j);
+	  for (uint32_t k = 0; k < j; ++k)
+	    sum -= B(i, k) * L(j, k);
+	  B(i, j) = sum / L(j, j);
+	}
+      return;
+    }
+    detail::run_tasks(par, 2, [=](int i, int child) {
+	trsm_right_lower_trans(L.quad(0, 0), B.quad(i, 0), child);
+	multiply_add(B.quad(i, 1), B.quad(i, 0), L.quad(1, 0), T(-1), true, child);
+	trsm_right_lower_trans(L.quad(1, 1), B.quad(i, 1), child);
+      });
+  }
+
+  // C += s * A * A^T, updating only the lower triangle of C (diagonal
+  // included). The strict upper triangle of C is neither read nor
+  // written, and only the diagonal and lower quadrants are recursed
+  // into, so this is half the work of multiply_add. The three quadrant
+  // updates for each half of the product are independent tasks.
+  template<class T>
+  void syrk_lower(block<T> C, block<T> A, T s = 1, int par = 1) {
+    assert(C.rank == A.rank);
+    const uint32_t n = C.rank;
+    if (n <= detail::leaf_rank) {
+      for (uint32_t i = 0; i < n; ++i)
+	for (uint32_t j = 0; j <= i; ++j) {
+	  T sum = 0;
+	  for (uint32_t k = 0; k < n; ++k)
+	    sum += A(i, k) * A(j, k);
+	  C(i, j) += s * sum;
+	}
+      return;
+    }
+    for (uint32_t k = 0; k < 2; ++k) {
+      detail::run_tasks(par, 3, [=](int t, int child) {
+	  if (t == 1)
+	    multiply_add(C.quad(1, 0), A.quad(1, k), A.quad(0, k), s, true, child);
+	  else
+	    syrk_lower(C.quad(t / 2, t / 2), A.quad(t / 2, k), s, child);
+	});
+    }
+  }
+
+  // Recursive Cholesky factorisation A = L L^T, in place.
+  //
+  // Only the lower triangle is read and overwritten with L; the strict
+  // upper triangle is left as it was. Returns false if A is not
+  // (numerically) positive definite.
+  template<class T>
+  bool cholesky(block<T> A, int par = 1) {
+    const uint32_t n = A.rank;
+    if (n <= detail::leaf_rank) {
+      for (uint32_t j = 0; j < n; ++j) {
+	T d = A(j, j);
+	for (uint32_t k = 0; k < j; ++k)
+	  d -= A(j, k) * A(j, k);
+	if (!(d > T(0)))
+	  return false;
+	d = std::sqrt(d);
+	A(j, j) = d;
+	for (uint32_t i = j + 1; i < n; ++i) {
+	  T sum = A(i, j);
+	  for (uint32_t k = 0; k < j; ++k)
+	    sum -= A(i, k) * A(j, k);
+	  A(i, j) = sum / d;
+	}
+      }
+      return true;
+    }
+    if (!cholesky(A.quad(0, 0), par))
+      return false;
+    trsm_right_lower_trans(A.quad(0, 0), A.quad(1, 0), par);
+    // Schur complement: A11 -= L10 L10^T, lower triangle only
+    syrk_lower(A.quad(1, 1), A.quad(1, 0), T(-1), par);
+    return cholesky(A.quad(1, 1), par);
+  }
+
+  template<class T>
+  bool cholesky(matrix<T>& A, int par = default_threads()) {
+    return cholesky(make_block(A), par);
+  }
+
+  namespace detail {
+    // A column of equally sized blocks stacked on top of each other.
+    // Partial pivoting needs to search and swap whole rows of the
+    // current column panel, so the LU recursion works on these.
+    template<class T>
+    struct panel {
+      std::vector<block<T>> blocks;
+
+      uint32_t width() const {
+	return blocks.front().rank;
+      }
+      uint32_t height() const {
+	return blocks.size() * width();
+      }
+      T& operator()(uint32_t i, uint32_t j) const {
+	const auto b = width();
+	return blocks[i / b](i % b, j);
+      }
+      void swap_rows(uint32_t r1, uint32_t r2) const {
+	if (r1 == r2)
+	  return;
+	for (uint32_t j = 0; j < width(); ++j)
+	  std::swap((*this)(r1, j), (*this)(r2, j));
+      }
+      // Left or right half of every block
+      panel half(uint32_t qj) const {
+	panel ans;
+	for (auto& blk: blocks) {
+	  ans.blocks.push_back(blk.quad(0, qj));
+	  ans.blocks.push_back(blk.quad(1, qj));
+	}
+	return ans;
+      }
+      // Drop the top block
+      panel tail() const {
+	panel ans;
+	ans.blocks.assign(blocks.begin() + 1, blocks.end());
+	return ans;
+      }
+    };
+
+    // Recursive LU with partial pivoting of a tall panel (Toledo's
+    // algorithm). piv[k] is the row (within the panel) swapped with
+    // row k at step k.
+    template<class T>
+    bool lu_panel(const panel<T>& P, uint32_t* piv, int par) {
+      const uint32_t w = P.width();
+      const uint32_t h = P.height();
+
+      if (w <= leaf_rank) {
+	bool ok = true;
+	for (uint32_t k = 0; k < w; ++k) {
+	  uint32_t p = k;
+	  T best = std::abs(P(k, k));
+	  for (uint32_t i = k + 1; i < h; ++i)
+	    if (std::abs(P(i, k)) > best) {
+	      best = std::abs(P(i, k));
+	      p = i;
+	    }
+	  piv[k] = p;
+	  if (best == T(0)) {
+	    ok = false;
+	    continue;
+	  }
+	  P.swap_rows(k, p);
+	  const T inv = T(1) / P(k, k);
+	  for (uint32_t i = k + 1; i < h; ++i)
+	    P(i, k) *= inv;
+	  for (uint32_t j = k + 1; j < w; ++j) {
+	    const T pkj = P(k, j);
+	    for (uint32_t i = k + 1; i < h; ++i)
+	      P(i, j) -= P(i, k) * pkj;
+	  }
+	}
+	return ok;
+      }
+
+      const uint32_t hw = w / 2;
+      auto left = P.half(0);
+      auto right = P.half(1);
+
+      bool ok = lu_panel(left, piv, par);
+      for (uint32_t k = 0; k < hw; ++k)
+	right.swap_rows(k, piv[k]);
+
+      // U12 = L11^-1 A12, then the Schur complement update of every
+      // block below it, which are all independent.
+      trsm_lower_unit(left.blocks[0], right.blocks[0], par);
+      const int nbelow = right.blocks.size() - 1;
+      run_tasks(par, nbelow, [&](int t, int child) {
+	  multiply_add(right.blocks[t+1], left.blocks[t+1], right.blocks[0],
+		       T(-1), false, child);
+	});
+
+      auto rtail = right.tail();
+      ok = lu_panel(rtail, piv + hw, par) && ok;
+      auto ltail = left.tail();
+      for (uint32_t k = 0; k < hw; ++k) {
+	ltail.swap_rows(k, piv[hw + k]);
+	piv[hw + k] += hw;
+      }
+      return ok;
+    }
+  }
+
+  // Recursive LU factorisation with partial pivoting, P A = L U, in
+  // place. L is unit lower triangular (diagonal not stored). Row k was
+  // swapped with row piv[k] at step k. Returns false if A is singular.
+  template<class T>
+  bool lu(block<T> A, std::vector<uint32_t>& piv, int par = 1) {
+    piv.resize(A.rank);
+    detail::panel<T> P;
+    P.blocks.push_back(A);
+    return detail::lu_panel(P, piv.data(), par);
+  }
+
+  template<class T>
+  bool lu(matrix<T>& A, std::vector<uint32_t>& piv, int par = default_threads()) {
+    return lu(make_block(A), piv, par);
+  }
+
+  // Solve A x = b using the output of lu
+  template<class T>
+  std::vector<T> lu_solve(const matrix<T>& LU, const std::vector<uint32_t>& piv,
+			  std::vector<T> b) {
+    const uint32_t n = LU.rank();
+    for (uint32_t k = 0; k < n; ++k)
+      std::swap(b[k], b[piv[k]]);
+    for (uint32_t i = 0; i < n; ++i)
+      for (uint32_t k = 0; k < i; ++k)
+	b[i] -= LU(i, k) * b[k];
+    for (uint32_t i = n; i-- > 0;) {
+      for (uint32_t k = i + 1; k < n; ++k)
+	b[i] -= LU(i, k) * b[k];
+      b[i] /= LU(i, i);
+    }
+    return b;
+  }
+
+  // Solve A x = b using the output of cholesky
+  template<class T>
+  std::vector<T> cholesky_solve(const matrix<T>& L, std::vector<T> b) {
+    const uint32_t n = L.rank();
+    for (uint32_t i = 0; i < n; ++i) {
+      for (uint32_t k = 0; k < i; ++k)
+	b[i] -= L(i, k) * b[k];
+      b[i] /= L(i, i);
+    }
+    for (uint32_t i = n; i-- > 0;) {
+      for (uint32_t k = i + 1; k < n; ++k)
+	b[i] -= L(k, i) * b[k];
+      b[i] /= L(i, i);
+    }
+    return b;
+  }
+}
+#endif
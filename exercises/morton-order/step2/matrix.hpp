@@ -6,10 +6,12 @@
 #include <iterator>
 #include <type_traits>
 #include "bits.hpp"
+#include "prefetch.hpp"
+#include "stream_copy.hpp"
 
 namespace morton {
   // Forward declare the iterator template
-  template<class T> class matrix_iterator;
+  template<class T, class Prefetch = no_prefetch> class matrix_iterator;
   
   // 2D square matrix that stores data in Morton order
   //
@@ -51,9 +53,12 @@ namespace morton {
     ~matrix() = default;
 
     // Create a new matrix with contents copied from this one
+    //
+    // Copying the raw data, rather than going through the iterators,
+    // lets big matrices be copied in parallel with streaming stores.
     matrix duplicate() const {
       matrix ans(_rank);
-      std::copy(begin(), end(), ans.begin());
+      stream_copy(data(), size(), ans.data());
       return ans;
     }
     
@@ -103,6 +108,25 @@ namespace morton {
       return const_iterator(data(), data() + size());
     }
 
+    // Iterators with a prefetch policy (see prefetch.hpp), e.g.
+    //   mat.begin<prefetch<64>>()
+    template<class Prefetch>
+    matrix_iterator<T, Prefetch> begin() {
+      return matrix_iterator<T, Prefetch>(data(), data());
+    }
+    template<class Prefetch>
+    matrix_iterator<T, Prefetch> end() {
+      return matrix_iterator<T, Prefetch>(data(), data() + size());
+    }
+    template<class Prefetch>
+    matrix_iterator<const T, Prefetch> begin() const {
+      return matrix_iterator<const T, Prefetch>(data(), data());
+    }
+    template<class Prefetch>
+    matrix_iterator<const T, Prefetch> end() const {
+      return matrix_iterator<const T, Prefetch>(data(), data() + size());
+    }
+
   private:
     // rank of matrix
     uint32_t _rank;
@@ -123,7 +147,10 @@ namespace morton {
   // It could relatively easily be changed to a random access iterator
   // by adding a few more operations - see:
   // https://en.cppreference.com/w/cpp/named_req/RandomAccessIterator
-  template<class T>
+
+  // The Prefetch policy says how far ahead (if at all) to prefetch as
+  // we move - see prefetch.hpp
+  template<class T, class Prefetch>
   class matrix_iterator :
     public std::iterator<std::bidirectional_iterator_tag,
 			 T, int64_t, T*, T&> {
@@ -163,11 +190,15 @@ namespace morton {
     // Preincrement operator
     matrix_iterator& operator++() {
       ++_ptr;
+      if (Prefetch::distance)
+	Prefetch::fetch(ahead(_ptr, Prefetch::distance));
       return *this;
     }
     // Predecrement operator
     matrix_iterator& operator--() {
       --_ptr;
+      if (Prefetch::distance)
+	Prefetch::fetch(ahead(_ptr, -Prefetch::distance));
       return *this;
     }      
     
@@ -0,0 +1,41 @@
+#ifndef MORTON_PREFETCH_HPP
+#define MORTON_PREFETCH_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+// Software prefetch policies for walking through Morton matrices.
+//
+// A policy has a distance (in elements, or steps of the traversal)
+// and a static fetch function. The iterators and traversal helpers
+// call fetch on the element that far ahead of the current one.
+namespace morton {
+
+  // Default: do nothing and leave it to the hardware
+  struct no_prefetch {
+    static const int distance = 0;
+    static void fetch(const void*) {
+    }
+  };
+
+  // Prefetch Distance steps ahead. Locality is as for
+  // __builtin_prefetch: 3 = keep in all cache levels, 0 = don't keep.
+  template<int Distance, int Locality = 3>
+  struct prefetch {
+    static const int distance = Distance;
+    static void fetch(const void* p) {
+#if defined(__GNUC__)
+      __builtin_prefetch(p, 0, Locality);
+#endif
+    }
+  };
+
+  // Pointer n elements on from p. Done on integers since the result
+  // may be outside the array, which is fine for a prefetch but not for
+  // pointer arithmetic.
+  template<class T>
+  const void* ahead(const T* p, std::ptrdiff_t n) {
+    return reinterpret_cast<const void*>(reinterpret_cast<std::uintptr_t>(p) + n * sizeof(T));
+  }
+}
+#endif
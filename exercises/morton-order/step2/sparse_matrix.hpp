@@ -0,0 +1,301 @@
+#ifndef MORTON_SPARSE_MATRIX_HPP
+#define MORTON_SPARSE_MATRIX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+#include "bits.hpp"
+#include "matrix.hpp"
+
+namespace morton {
+  template<class T> class sparse_iterator;
+
+  // 2D square matrix that only stores the leaf quadrants ("tiles")
+  // that contain a non-default value. This is a linear quadtree: each
+  // stored tile is identified by its Morton prefix, i.e. the Morton
+  // index of any of its elements shifted right by 2*log2(leaf) bits.
+  //
+  // The prefixes are kept in a sorted array and the tile data in a
+  // second array in the same order, with each tile stored
+  // contiguously in Morton order. So a tile looks exactly like the
+  // corresponding chunk of a dense morton::matrix.
+  //
+  // NB:
+  //
+  //  - rank and leaf size must be powers of 2
+  //
+  //  - reading an absent element gives a default constructed T
+  //
+  //  - mutable element access creates the tile if it's absent, which
+  //    means shifting the following tiles along. Build from a dense
+  //    matrix or insert in Morton order if you have lots of data.
+  //
+  //  - like matrix, must use explicit duplicate to copy
+  template<class T>
+  class sparse_matrix {
+  public:
+    using iterator = sparse_iterator<T>;
+    using const_iterator = sparse_iterator<const T>;
+
+    sparse_matrix() : _rank(0), _leaf(1), _shift(0), _zero() {
+    }
+
+    sparse_matrix(uint32_t r, uint32_t leaf = 8)
+      : _rank(r), _leaf(std::min(r, leaf)), _shift(0), _zero() {
+      assert((r & (r-1)) == 0);
+      assert((leaf & (leaf-1)) == 0);
+      while ((1U << _shift) < _leaf)
+	++_shift;
+      _shift *= 2;
+    }
+
+    // Build from a dense matrix, skipping tiles that are entirely
+    // default valued.
+    static sparse_matrix from_dense(const matrix<T>& dense, uint32_t leaf = 8) {
+      sparse_matrix ans(dense.rank(), leaf);
+      const auto n = ans.tile_size();
+      const auto ntiles = dense.size() / n;
+      const T* src = dense.data();
+      for (uint64_t t = 0; t < ntiles; ++t, src += n) {
+	if (std::all_of(src, src + n, [&](const T& v) { return v == ans._zero; }))
+	  continue;
+	ans._keys.push_back(t);
+	ans._data.insert(ans._data.end(), src, src + n);
+      }
+      return ans;
+    }
+
+    sparse_matrix(const sparse_matrix& other) = delete;
+    sparse_matrix& operator=(const sparse_matrix& other) = delete;
+    sparse_matrix(sparse_matrix&& other) noexcept = default;
+    sparse_matrix& operator=(sparse_matrix&& other) noexcept = default;
+    ~sparse_matrix() = default;
+
+    sparse_matrix duplicate() const {
+      sparse_matrix ans(_rank, _leaf);
+      ans._keys = _keys;
+      ans._data = _data;
+      return ans;
+    }
+
+    // Expand into a dense matrix
+    matrix<T> to_dense() const {
+      matrix<T> ans(_rank);
+      std::fill(ans.data(), ans.data() + ans.size(), _zero);
+      for (std::size_t t = 0; t < _keys.size(); ++t)
+	std::copy(tile_data(t), tile_data(t) + tile_size(),
+		  ans.data() + (_keys[t] << _shift));
+      return ans;
+    }
+
+    uint32_t rank() const {
+      return _rank;
+    }
+    uint64_t size() const {
+      return uint64_t(_rank) * uint64_t(_rank);
+    }
+
+    // Linear size of the leaf tiles
+    uint32_t leaf() const {
+      return _leaf;
+    }
+    // Number of elements in a tile
+    uint64_t tile_size() const {
+      return uint64_t(1) << _shift;
+    }
+    // Number of stored tiles
+    std::size_t tile_count() const {
+      return _keys.size();
+    }
+    // Number of elements actually stored
+    uint64_t stored_size() const {
+      return _data.size();
+    }
+
+    // Morton prefix of the t'th stored tile
+    uint64_t tile_key(std::size_t t) const {
+      return _keys[t];
+    }
+    const T* tile_data(std::size_t t) const {
+      return _data.data() + t * tile_size();
+    }
+    T* tile_data(std::size_t t) {
+      return _data.data() + t * tile_size();
+    }
+
+    // Const element access - absent elements are default valued
+    const T& operator()(uint32_t i, uint32_t j) const {
+      auto z = encode(i, j);
+      auto t = find(z >> _shift);
+      if (t == _keys.size())
+	return _zero;
+      return tile_data(t)[z & offset_mask()];
+    }
+
+    // Mutable element access - creates the tile if needed
+    T& operator()(uint32_t i, uint32_t j) {
+      auto z = encode(i, j);
+      auto t = find_or_insert(z >> _shift);
+      return tile_data(t)[z & offset_mask()];
+    }
+
+    // Remove any tiles that have become entirely default valued
+    void prune() {
+      const auto n = tile_size();
+      std::size_t out = 0;
+      for (std::size_t t = 0; t < _keys.size(); ++t) {
+	const T* src = tile_data(t);
+	if (std::all_of(src, src + n, [&](const T& v) { return v == _zero; }))
+	  continue;
+	if (out != t) {
+	  _keys[out] = _keys[t];
+	  std::copy(src, src + n, tile_data(out));
+	}
+	++out;
+      }
+      _keys.resize(out);
+      _data.resize(out * n);
+    }
+
+    // Compute y = A x, where x and y have rank() elements. Only the
+    // stored tiles are visited, and each touches just leaf() elements
+    // of x and y.
+    void multiply(const T* x, T* y) const {
+      std::fill(y, y + _rank, _zero);
+
+      // Local (i, j) of each offset within a tile is the same for
+      // every tile, so decode it once.
+      const auto n = tile_size();
+      std::vector<uint32_t> li(n), lj(n);
+      for (uint64_t z = 0; z < n; ++z)
+	decode(z, li[z], lj[z]);
+
+      for (std::size_t t = 0; t < _keys.size(); ++t) {
+	uint32_t ti, tj;
+	decode(_keys[t], ti, tj);
+	const T* a = tile_data(t);
+	const T* xt = x + uint64_t(tj) * _leaf;
+	T* yt = y + uint64_t(ti) * _leaf;
+	for (uint64_t z = 0; z < n; ++z)
+	  yt[li[z]] += a[z] * xt[lj[z]];
+      }
+    }
+
+    std::vector<T> operator*(const std::vector<T>& x) const {
+      assert(x.size() == _rank);
+      std::vector<T> y(_rank);
+      multiply(x.data(), y.data());
+      return y;
+    }
+
+    // Iterators visit the stored elements only, in Morton order
+    iterator begin() {
+      return iterator(this, 0);
+    }
+    iterator end() {
+      return iterator(this, stored_size());
+    }
+    const_iterator begin() const {
+      return const_iterator(this, 0);
+    }
+    const_iterator end() const {
+      return const_iterator(this, stored_size());
+    }
+
+  private:
+    uint64_t offset_mask() const {
+      return tile_size() - 1;
+    }
+
+    // Index of tile with the given key, or tile_count() if absent
+    std::size_t find(uint64_t key) const {
+      auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+      if (it == _keys.end() || *it != key)
+	return _keys.size();
+      return it - _keys.begin();
+    }
+
+    std::size_t find_or_insert(uint64_t key) {
+      auto it = std::lower_bound(_keys.begin(), _keys.end(), key);
+      std::size_t t = it - _keys.begin();
+      if (it == _keys.end() || *it != key) {
+	_keys.insert(it, key);
+	_data.insert(_data.begin() + t * tile_size(), tile_size(), _zero);
+      }
+      return t;
+    }
+
+    friend sparse_iterator<T>;
+    friend sparse_iterator<const T>;
+
+    uint32_t _rank;
+    uint32_t _leaf;
+    // 2*log2(leaf) - number of Morton bits addressing within a tile
+    uint32_t _shift;
+    // Sorted Morton prefixes of the stored tiles
+    std::vector<uint64_t> _keys;
+    // Tile contents, in the same order as _keys
+    std::vector<T> _data;
+    // Value of absent elements
+    T _zero;
+  };
+
+  // Bidirectional iterator over the stored elements, with the same
+  // x()/y() interface as matrix_iterator.
+  template<class T>
+  class sparse_iterator :
+    public std::iterator<std::bidirectional_iterator_tag,
+			 T, int64_t, T*, T&> {
+    using owner_t = typename std::conditional<std::is_const<T>::value,
+					      const sparse_matrix<typename std::remove_const<T>::type>,
+					      sparse_matrix<T>>::type;
+  public:
+    sparse_iterator() : _mat(nullptr), _pos(0) {
+    }
+
+    // Morton index of the current element in the full matrix
+    uint64_t z() const {
+      auto t = _pos >> _mat->_shift;
+      return (_mat->_keys[t] << _mat->_shift) | (_pos & _mat->offset_mask());
+    }
+    uint32_t x() const {
+      return pack(z());
+    }
+    uint32_t y() const {
+      return pack(z() >> 1);
+    }
+
+    friend bool operator==(const sparse_iterator& a, const sparse_iterator& b) {
+      return a._pos == b._pos;
+    }
+    friend bool operator!=(const sparse_iterator& a, const sparse_iterator& b) {
+      return !(a == b);
+    }
+
+    T& operator*() const {
+      return _mat->_data[_pos];
+    }
+
+    sparse_iterator& operator++() {
+      ++_pos;
+      return *this;
+    }
+    sparse_iterator& operator--() {
+      --_pos;
+      return *this;
+    }
+
+  private:
+    sparse_iterator(owner_t* mat, uint64_t pos) : _mat(mat), _pos(pos) {
+    }
+    friend sparse_matrix<typename std::remove_const<T>::type>;
+
+    owner_t* _mat;
+    // Position in the stored data
+    uint64_t _pos;
+  };
+
+}
+#endif
@@ -0,0 +1,97 @@
+#ifndef MORTON_STREAM_COPY_HPP
+#define MORTON_STREAM_COPY_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace morton {
+  namespace detail {
+    // Copies smaller than this are done with plain memcpy: the
+    // destination will probably be used soon so should stay in cache.
+    const std::size_t stream_min_bytes = std::size_t(1) << 20;
+    // Give each thread at least this much to copy
+    const std::size_t bytes_per_thread = std::size_t(1) << 22;
+
+    // Copy n bytes, using non-temporal stores (i.e. bypassing the
+    // cache) where possible. A big copy would otherwise evict
+    // everything else from the cache, and the CPU has to read each
+    // destination line before overwriting it.
+    inline void stream_bytes(char* dst, const char* src, std::size_t n) {
+#ifdef __SSE2__
+      // Bring dst up to 16 byte alignment
+      std::size_t head = (16 - (reinterpret_cast<std::uintptr_t>(dst) & 15)) & 15;
+      head = std::min(head, n);
+      std::memcpy(dst, src, head);
+      dst += head;
+      src += head;
+      n -= head;
+
+      const std::size_t nvec = n / 16;
+      auto d = reinterpret_cast<__m128i*>(dst);
+      auto s = reinterpret_cast<const __m128i*>(src);
+      for (std::size_t i = 0; i < nvec; ++i)
+	_mm_stream_si128(d + i, _mm_loadu_si128(s + i));
+      // Streaming stores are weakly ordered - make sure they're done
+      // before anyone else can look at them.
+      _mm_sfence();
+
+      std::memcpy(dst + 16*nvec, src + 16*nvec, n - 16*nvec);
+#else
+      std::memcpy(dst, src, n);
+#endif
+    }
+  }
+
+  // Copy n elements from src to dst. For trivially copyable types
+  // and large sizes, the raw bytes are split between threads and
+  // copied with streaming stores.
+  template<class T>
+  void stream_copy(const T* src, std::size_t n, T* dst, unsigned nthreads = 0) {
+    if (!std::is_trivially_copyable<T>::value) {
+      std::copy(src, src + n, dst);
+      return;
+    }
+
+    const std::size_t bytes = n * sizeof(T);
+    auto s = reinterpret_cast<const char*>(src);
+    auto d = reinterpret_cast<char*>(dst);
+    if (bytes < detail::stream_min_bytes) {
+      std::memcpy(d, s, bytes);
+      return;
+    }
+
+    if (nthreads == 0)
+      nthreads = std::max(1U, std::thread::hardware_concurrency());
+    nthreads = std::min<std::size_t>(nthreads, bytes / detail::bytes_per_thread);
+    if (nthreads <= 1) {
+      detail::stream_bytes(d, s, bytes);
+      return;
+    }
+
+    // Split on cache line boundaries so threads don't share lines
+    const std::size_t line = 64;
+    std::vector<std::thread> threads;
+    std::size_t begin = 0;
+    for (unsigned t = 0; t < nthreads; ++t) {
+      std::size_t end = (t + 1 == nthreads) ? bytes : (bytes / nthreads) * (t + 1) / line * line;
+      if (t + 1 == nthreads) {
+	// Do the last chunk on this thread
+	detail::stream_bytes(d + begin, s + begin, end - begin);
+      } else {
+	threads.emplace_back(detail::stream_bytes, d + begin, s + begin, end - begin);
+      }
+      begin = end;
+    }
+    for (auto& th: threads)
+      th.join();
+  }
+}
+#endif
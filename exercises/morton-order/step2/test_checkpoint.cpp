@@ -0,0 +1,113 @@
+#include <iterator>
+#include <sstream>
+#include <vector>
+
+#include "checkpoint.hpp"
+#include "test.hpp"
+#include "range.hpp"
+
+morton::matrix<double> make_filled(int N) {
+  morton::matrix<double> mat(N);
+  for (auto i: range(N))
+    for (auto j: range(N))
+      mat(i, j) = i*N + j;
+  return mat;
+}
+
+bool test_tracking() {
+  const int N = 16;
+  // Level 2 => 4x4 grid of 4x4 quadrants
+  morton::tracked_matrix<double> mat(make_filled(N), 2);
+  TEST_ASSERT_EQUAL(16U, mat.quadrant_count());
+  TEST_ASSERT_EQUAL(0U, mat.dirty_quadrants().size());
+
+  // Reads don't count as writes, even through mutable access
+  const auto& cmat = mat;
+  double sum = 0;
+  for (auto it = cmat.begin(); it != cmat.end(); ++it)
+    sum += *it;
+  for (auto it = mat.begin(); it != mat.end(); ++it)
+    sum += *it;
+  sum += cmat(3, 3) + mat(4, 4);
+  TEST_ASSERT_EQUAL(255.0 * 256 + 3*N + 3 + 4*N + 4, sum);
+  TEST_ASSERT_EQUAL(0U, mat.dirty_quadrants().size());
+
+  // (5, 0) is in quadrant (1, 0) => Morton index 1
+  mat(5, 0) = -1;
+  // (15, 15) is the last quadrant
+  mat(15, 15) += 1;
+  TEST_ASSERT_EQUAL(-1.0, cmat(5, 0));
+  TEST_ASSERT_EQUAL(256.0, cmat(15, 15));
+  auto dirty = mat.dirty_quadrants();
+  TEST_ASSERT_EQUAL(2U, dirty.size());
+  TEST_ASSERT_EQUAL(1U, dirty[0]);
+  TEST_ASSERT_EQUAL(15U, dirty[1]);
+
+  // Writes through mutable iterators are tracked too
+  mat.clear_dirty();
+  auto it = mat.begin();
+  std::advance(it, 2 * 16);
+  *it = 0;
+  dirty = mat.dirty_quadrants();
+  TEST_ASSERT_EQUAL(1U, dirty.size());
+  TEST_ASSERT_EQUAL(2U, dirty[0]);
+  return true;
+}
+
+bool test_runs() {
+  const int N = 16;
+  morton::tracked_matrix<double> mat(make_filled(N), 2);
+  // Quadrants 4, 5 and 7
+  mat(8, 0) = 0;
+  mat(12, 0) = 0;
+  mat(12, 4) = 0;
+  auto runs = morton::dirty_runs(mat);
+  const uint64_t qbytes = 16 * sizeof(double);
+  TEST_ASSERT_EQUAL(2U, runs.size());
+  TEST_ASSERT_EQUAL(4 * qbytes, runs[0].first);
+  TEST_ASSERT_EQUAL(2 * qbytes, runs[0].second);
+  TEST_ASSERT_EQUAL(7 * qbytes, runs[1].first);
+  TEST_ASSERT_EQUAL(qbytes, runs[1].second);
+  return true;
+}
+
+bool test_restore() {
+  const int N = 64;
+  morton::tracked_matrix<double> mat(make_filled(N), 3);
+
+  // First checkpoint is everything
+  std::stringstream full, incr1, incr2;
+  auto bytes = morton::write_checkpoint(full, mat.base());
+  TEST_ASSERT_EQUAL(mat.size() * sizeof(double), bytes);
+
+  // A "moving front" down the diagonal
+  for (auto i: range(8))
+    mat(i, i) = -1.0;
+  bytes = morton::write_checkpoint(incr1, mat);
+  TEST_ASSERT_EQUAL(64U * sizeof(double), bytes);
+
+  for (auto i: range(8, 16))
+    mat(i, i) = -2.0;
+  bytes = morton::write_checkpoint(incr2, mat);
+  TEST_ASSERT_EQUAL(64U * sizeof(double), bytes);
+
+  morton::matrix<double> restored(N);
+  TEST_ASSERT_EQUAL(true, morton::read_checkpoint(full, restored));
+  TEST_ASSERT_EQUAL(true, morton::read_checkpoint(incr1, restored));
+  TEST_ASSERT_EQUAL(true, morton::read_checkpoint(incr2, restored));
+  for (auto z: range(mat.size()))
+    TEST_ASSERT_EQUAL(mat.data()[z], restored.data()[z]);
+
+  // Wrong rank is rejected
+  morton::matrix<double> wrong(32);
+  full.seekg(0);
+  TEST_ASSERT_EQUAL(false, morton::read_checkpoint(full, wrong));
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_tracking);
+  RUN_TEST(test_runs);
+  RUN_TEST(test_restore);
+  return 0;
+}
@@ -0,0 +1,153 @@
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+#include "compressed_matrix.hpp"
+#include "test.hpp"
+#include "range.hpp"
+
+// Compare bit patterns, so NaNs and -0 count
+template<class T>
+bool same_bits(T a, T b) {
+  return std::memcmp(&a, &b, sizeof(T)) == 0;
+}
+
+template<class T>
+bool check_codec() {
+  std::vector<T> src = {
+    T(0), T(-0.0), T(1), T(1), T(1.5), T(-1e30),
+    std::numeric_limits<T>::infinity(), std::numeric_limits<T>::quiet_NaN(),
+    std::numeric_limits<T>::denorm_min(), std::numeric_limits<T>::max(),
+    T(3.14159), T(2.71828), T(0)
+  };
+  // Some noisy values too
+  uint32_t state = 12345;
+  for (int k = 0; k < 100; ++k) {
+    state = state * 1664525U + 1013904223U;
+    src.push_back(T(state) / T(7));
+  }
+  std::vector<uint8_t> packed;
+  morton::detail::compress(src.data(), src.size(), packed);
+  std::vector<T> out(src.size());
+  morton::detail::decompress(packed, out.size(), out.data());
+  for (auto k: range(src.size()))
+    if (!same_bits(src[k], out[k])) {
+      std::cerr << "FAIL! Value " << k << " changed" << std::endl;
+      return false;
+    }
+  return true;
+}
+
+bool test_codec() {
+  return check_codec<float>() && check_codec<double>();
+}
+
+// A smooth field, with values that use the whole mantissa
+template<class T>
+morton::matrix<T> make_field(int N) {
+  morton::matrix<T> mat(N);
+  for (auto i: range(N))
+    for (auto j: range(N))
+      mat(i, j) = T(std::sin(0.02 * i + 0.3) * std::cos(0.03 * j));
+  return mat;
+}
+
+template<class T>
+bool check_round_trip(double min_ratio) {
+  const int N = 256;
+  auto m = make_field<T>(N);
+  m(3, 5) = T(-1e30);
+  auto c = morton::compressed_matrix<T>::from_matrix(m, 32, 4);
+  TEST_ASSERT_EQUAL(64U, c.tile_count());
+  TEST_ASSERT_EQUAL(1024U, c.tile_size());
+  for (auto i: range(N))
+    for (auto j: range(N))
+      TEST_ASSERT_EQUAL(m(i, j), c(i, j));
+
+  auto back = c.to_matrix();
+  for (auto z: range(m.size()))
+    if (!same_bits(m.data()[z], back.data()[z])) {
+      std::cerr << "FAIL! Element " << z << " changed" << std::endl;
+      return false;
+    }
+
+  // Smooth data should shrink a lot
+  if (c.ratio() < min_ratio) {
+    std::cerr << "FAIL! Compression ratio only " << c.ratio() << std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool test_round_trip() {
+  return check_round_trip<double>(2.0) && check_round_trip<float>(3.0);
+}
+
+// Tiles too small for the full predictor
+bool test_tiny() {
+  for (uint32_t tile: {1U, 2U, 4U}) {
+    auto m = make_field<double>(16);
+    auto c = morton::compressed_matrix<double>::from_matrix(m, tile, 2);
+    for (auto z: range(m.size()))
+      TEST_ASSERT_EQUAL(m.data()[z], c.to_matrix().data()[z]);
+  }
+  return true;
+}
+
+bool test_writes() {
+  const int N = 64;
+  // Only two tiles fit in the cache, so writes get evicted and
+  // recompressed many times
+  morton::compressed_matrix<float> c(N, 8, 2);
+  TEST_ASSERT_EQUAL(0.0f, c(N-1, N-1));
+  for (auto i: range(N))
+    for (auto j: range(N))
+      c.set(j, i, float(i) - 0.5f * j);
+  for (auto i: range(N))
+    for (auto j: range(N))
+      TEST_ASSERT_EQUAL(float(i) - 0.5f * j, c(j, i));
+
+  auto dup = c.duplicate();
+  c.set(0, 0, 42.0f);
+  TEST_ASSERT_EQUAL(42.0f, c(0, 0));
+  TEST_ASSERT_EQUAL(0.0f, dup(0, 0));
+  TEST_ASSERT_EQUAL(-0.5f, dup(1, 0));
+  return true;
+}
+
+bool test_lru() {
+  const int N = 64;
+  auto c = morton::compressed_matrix<double>::from_matrix(make_field<double>(N), 16, 2);
+  // Tiles 0 and 1 fit, so alternating between them only loads each once
+  for (int k = 0; k < 10; ++k) {
+    c.tile_data(0);
+    c.tile_data(1);
+  }
+  TEST_ASSERT_EQUAL(2U, c.cache_misses());
+  // Tile 2 evicts tile 0, the least recently used
+  c.tile_data(2);
+  c.tile_data(1);
+  TEST_ASSERT_EQUAL(3U, c.cache_misses());
+  c.tile_data(0);
+  TEST_ASSERT_EQUAL(4U, c.cache_misses());
+
+  // A tile pointer can be used to work on a whole tile. Tile 3 is
+  // elements (16..31, 16..31).
+  double* t = c.tile_data(3);
+  for (auto k: range(c.tile_size()))
+    t[k] = -1.0;
+  c.flush();
+  TEST_ASSERT_EQUAL(-1.0, c(31, 31));
+  TEST_ASSERT_EQUAL(-1.0, c.to_matrix()(16, 16));
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_codec);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_tiny);
+  RUN_TEST(test_writes);
+  RUN_TEST(test_lru);
+  return 0;
+}
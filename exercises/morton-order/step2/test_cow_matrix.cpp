@@ -0,0 +1,96 @@
+#include <numeric>
+#include <vector>
+
+#include "cow_matrix.hpp"
+#include "test.hpp"
+#include "range.hpp"
+
+bool test_stream_copy() {
+  // Odd sizes and offsets to exercise the unaligned head and tail,
+  // with more threads than cores.
+  const std::size_t n = (std::size_t(3) << 20) + 7;
+  std::vector<int> src(n + 1), dst(n + 1, -1);
+  std::iota(src.begin(), src.end(), 0);
+  morton::stream_copy(src.data() + 1, n, dst.data() + 1, 4);
+  TEST_ASSERT_EQUAL(-1, dst[0]);
+  for (std::size_t i = 1; i <= n; ++i)
+    TEST_ASSERT_EQUAL(src[i], dst[i]);
+  return true;
+}
+
+morton::matrix<int> make_filled(int N) {
+  morton::matrix<int> mat(N);
+  for (auto i: range(N))
+    for (auto j: range(N))
+      mat(i, j) = i*N + j;
+  return mat;
+}
+
+bool test_round_trip() {
+  const int N = 64;
+  auto m = make_filled(N);
+  auto cow = morton::cow_matrix<int>::from_matrix(m, 2);
+  TEST_ASSERT_EQUAL(16U, cow.quadrant_count());
+  TEST_ASSERT_EQUAL(16U*16U, cow.quadrant_size());
+  for (auto i: range(N))
+    for (auto j: range(N))
+      TEST_ASSERT_EQUAL(m(i, j), cow(i, j));
+
+  auto back = cow.to_matrix();
+  for (auto z: range(m.size()))
+    TEST_ASSERT_EQUAL(m.data()[z], back.data()[z]);
+  return true;
+}
+
+bool test_copy_on_write() {
+  const int N = 64;
+  auto orig = morton::cow_matrix<int>::from_matrix(make_filled(N), 3);
+  TEST_ASSERT_EQUAL(0U, orig.shared_count());
+
+  auto dup = orig.duplicate();
+  TEST_ASSERT_EQUAL(64U, orig.shared_count());
+  TEST_ASSERT_EQUAL(64U, dup.shared_count());
+
+  // Const access must not unshare
+  const auto& cdup = dup;
+  TEST_ASSERT_EQUAL(N + 1, cdup(1, 1));
+  TEST_ASSERT_EQUAL(64U, dup.shared_count());
+
+  // Writing gives dup its own copy of just that quadrant
+  dup(1, 1) = -1;
+  dup(2, 3) = -2;
+  TEST_ASSERT_EQUAL(63U, dup.shared_count());
+  TEST_ASSERT_EQUAL(63U, orig.shared_count());
+  TEST_ASSERT_EQUAL(-1, cdup(1, 1));
+  TEST_ASSERT_EQUAL(-2, cdup(2, 3));
+  TEST_ASSERT_EQUAL(N + 1, orig(1, 1));
+  TEST_ASSERT_EQUAL(2*N + 3, orig(2, 3));
+  // The rest of the copied quadrant must be intact
+  TEST_ASSERT_EQUAL(N*3 + 2, cdup(3, 2));
+
+  // Writing to the original once dup has its own copy doesn't need
+  // another one
+  orig(1, 1) = 7;
+  TEST_ASSERT_EQUAL(-1, cdup(1, 1));
+  TEST_ASSERT_EQUAL(63U, orig.shared_count());
+  return true;
+}
+
+bool test_tiny() {
+  // Level deeper than the matrix allows is clamped
+  morton::cow_matrix<double> m(2, 4);
+  TEST_ASSERT_EQUAL(4U, m.quadrant_count());
+  m(1, 0) = 3.0;
+  TEST_ASSERT_EQUAL(3.0, m(1, 0));
+  return true;
+}
+
+int main() {
+  static_assert(!std::is_copy_constructible<morton::cow_matrix<char>>::value,
+		"Require that COW matrix is not copyable");
+  RUN_TEST(test_stream_copy);
+  RUN_TEST(test_round_trip);
+  RUN_TEST(test_copy_on_write);
+  RUN_TEST(test_tiny);
+  return 0;
+}
@@ -0,0 +1,247 @@
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <vector>
+
+#include "linalg.hpp"
+#include "test.hpp"
+#include "range.hpp"
+
+// Simple reproducible pseudo-random numbers in [-1, 1)
+struct lcg {
+  uint64_t state;
+  double operator()() {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    return double(state >> 11) / double(1UL << 52) - 1.0;
+  }
+};
+
+morton::matrix<double> make_random(uint32_t N, uint64_t seed) {
+  morton::matrix<double> mat(N);
+  lcg rng{seed};
+  for (auto& x: mat)
+    x = rng();
+  return mat;
+}
+
+#define TEST_ASSERT_CLOSE(expected, actual, tol)			\
+  if (std::abs((expected) - (actual)) > tol) {				\
+    std::cerr << "FAIL! Expected '" << (expected)			\
+	      << "' Got '" << (actual) << "'" << std::endl;		\
+    return false;							\
+  }
+
+// Nested tasks, as the recursive routines make, recording the most
+// that were running at once
+void nested_tasks(int par, int depth, std::atomic<int>& active, std::atomic<int>& most) {
+  morton::detail::run_tasks(par, 4, [&](int, int child) {
+      if (depth > 1) {
+	nested_tasks(child, depth - 1, active, most);
+	return;
+      }
+      const int now = ++active;
+      int prev = most;
+      while (now > prev && !most.compare_exchange_weak(prev, now))
+	;
+      std::this_thread::sleep_for(std::chrono::milliseconds(5));
+      --active;
+    });
+}
+
+bool test_task_limit() {
+  for (int par: {1, 2, 3, 6, 8, 16}) {
+    std::atomic<int> active(0), most(0);
+    nested_tasks(par, 3, active, most);
+    // The sleeps overlap even on one core, so all par should be used
+    TEST_ASSERT_EQUAL(par, most.load());
+  }
+  return true;
+}
+
+bool test_multiply() {
+  const uint32_t N = 128;
+  auto A = make_random(N, 1);
+  auto B = make_random(N, 2);
+  // Use several threads even if the machine has only one core
+  auto C = morton::multiply(A, B, 4);
+  for (auto i: range(N))
+    for (auto j: range(N)) {
+      double expect = 0;
+      for (auto k: range(N))
+	expect += A(i, k) * B(k, j);
+      TEST_ASSERT_CLOSE(expect, C(i, j), 1e-10);
+    }
+  return true;
+}
+
+bool test_lu() {
+  const uint32_t N = 256;
+  auto A = make_random(N, 3);
+  auto LU = A.duplicate();
+  std::vector<uint32_t> piv;
+  TEST_ASSERT_EQUAL(true, morton::lu(LU, piv, 4));
+
+  // Check P A = L U row by row
+  std::vector<uint32_t> perm(N);
+  for (auto i: range(N))
+    perm[i] = i;
+  for (auto k: range(N))
+    std::swap(perm[k], perm[piv[k]]);
+  for (auto i: range(N))
+    for (auto j: range(N)) {
+      double lu = 0;
+      for (uint32_t k = 0; k <= std::min(i, j); ++k)
+	lu += (k == i ? 1.0 : LU(i, k)) * LU(k, j);
+      TEST_ASSERT_CLOSE(A(perm[i], j), lu, 1e-10);
+    }
+
+  // Partial pivoting means |L| <= 1
+  for (auto i: range(N))
+    for (uint32_t j = 0; j < i; ++j)
+      if (std::abs(LU(i, j)) > 1.0) {
+	std::cerr << "FAIL! |L(" << i << "," << j << ")| > 1" << std::endl;
+	return false;
+      }
+
+  std::vector<double> x(N), b(N, 0.0);
+  for (auto i: range(N))
+    x[i] = i % 5 - 2.0;
+  for (auto i: range(N))
+    for (auto j: range(N))
+      b[i] += A(i, j) * x[j];
+  auto sol = morton::lu_solve(LU, piv, b);
+  for (auto i: range(N))
+    TEST_ASSERT_CLOSE(x[i], sol[i], 1e-8);
+  return true;
+}
+
+bool test_lu_singular() {
+  const uint32_t N = 64;
+  morton::matrix<double> A(N);
+  std::fill(A.data(), A.data() + A.size(), 1.0);
+  std::vector<uint32_t> piv;
+  TEST_ASSERT_EQUAL(false, morton::lu(A, piv, 1));
+  return true;
+}
+
+bool test_cholesky() {
+  const uint32_t N = 256;
+  // A = M M^T + N I is symmetric positive definite
+  auto M = make_random(N, 4);
+  morton::matrix<double> A(N);
+  for (auto i: range(N))
+    for (auto j: range(N)) {
+      double sum = (i == j) ? N : 0.0;
+      for (auto k: range(N))
+	sum += M(i, k) * M(j, k);
+      A(i, j) = sum;
+    }
+
+  // Fill the strict upper triangle with a marker, which must survive
+  auto L = A.duplicate();
+  for (auto i: range(N))
+    for (auto j: range(i + 1, N))
+      L(i, j) = -7.0;
+  TEST_ASSERT_EQUAL(true, morton::cholesky(L, 4));
+  for (auto i: range(N))
+    for (auto j: range(i + 1, N))
+      TEST_ASSERT_EQUAL(-7.0, L(i, j));
+  for (auto i: range(N))
+    for (uint32_t j = 0; j <= i; ++j) {
+      double sum = 0;
+      for (uint32_t k = 0; k <= j; ++k)
+	sum += L(i, k) * L(j, k);
+      TEST_ASSERT_CLOSE(A(i, j), sum, 1e-9);
+    }
+
+  std::vector<double> b(N, 1.0);
+  auto x = morton::cholesky_solve(L, b);
+  for (auto i: range(N)) {
+    double ax = 0;
+    for (auto j: range(N))
+      ax += A(i, j) * x[j];
+    TEST_ASSERT_CLOSE(1.0, ax, 1e-9);
+  }
+
+  // Not positive definite
+  auto neg = make_random(64, 5);
+  for (auto i: range(64))
+    neg(i, i) = -1.0;
+  TEST_ASSERT_EQUAL(false, morton::cholesky(neg, 1));
+  return true;
+}
+
+bool test_syrk_lower() {
+  const uint32_t N = 128;
+  auto A = make_random(N, 10);
+  auto C = make_random(N, 11);
+  auto C0 = C.duplicate();
+  morton::syrk_lower(morton::make_block(C), morton::make_block(A), -1.0, 4);
+  for (auto i: range(N))
+    for (auto j: range(N)) {
+      if (j > i) {
+	TEST_ASSERT_EQUAL(C0(i, j), C(i, j));
+	continue;
+      }
+      double expect = C0(i, j);
+      for (auto k: range(N))
+	expect -= A(i, k) * A(j, k);
+      TEST_ASSERT_CLOSE(expect, C(i, j), 1e-10);
+    }
+  return true;
+}
+
+bool test_gemv() {
+  for (uint32_t N: {2U, 8U, 256U}) {
+    auto A = make_random(N, 6);
+    std::vector<double> x(N);
+    lcg rng{7};
+    for (auto& xi: x)
+      xi = rng();
+
+    auto y = morton::gemv(A, x, 4);
+    for (auto i: range(N)) {
+      double expect = 0;
+      for (auto j: range(N))
+	expect += A(i, j) * x[j];
+      TEST_ASSERT_CLOSE(expect, y[i], 1e-12);
+    }
+  }
+  return true;
+}
+
+bool test_yAx() {
+  const uint32_t N = 512;
+  auto A = make_random(N, 8);
+  std::vector<double> x(N), y(N);
+  lcg rng{9};
+  for (auto i: range(N)) {
+    x[i] = rng();
+    y[i] = rng();
+  }
+
+  double expect = 0;
+  for (auto i: range(N))
+    for (auto j: range(N))
+      expect += y[i] * A(i, j) * x[j];
+
+  auto serial = morton::yAx(y, A, x, 1);
+  TEST_ASSERT_CLOSE(expect, serial, 1e-9);
+  // The reduction order is fixed, so must be bitwise the same
+  for (int par: {2, 3, 16})
+    TEST_ASSERT_EQUAL(serial, morton::yAx(y, A, x, par));
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_task_limit);
+  RUN_TEST(test_multiply);
+  RUN_TEST(test_lu);
+  RUN_TEST(test_lu_singular);
+  RUN_TEST(test_cholesky);
+  RUN_TEST(test_syrk_lower);
+  RUN_TEST(test_gemv);
+  RUN_TEST(test_yAx);
+  return 0;
+}
@@ -0,0 +1,128 @@
+#include <vector>
+
+#include "sparse_matrix.hpp"
+#include "test.hpp"
+#include "range.hpp"
+
+// Dense matrix with a few non-zeros in two corners
+morton::matrix<int> make_corners(int N) {
+  morton::matrix<int> mat(N);
+  std::fill(mat.data(), mat.data() + mat.size(), 0);
+  mat(0, 0) = 1;
+  mat(1, 2) = 2;
+  mat(N-1, N-1) = 3;
+  mat(N-2, N-5) = 4;
+  return mat;
+}
+
+bool test_element_access() {
+  const int N = 32;
+  morton::sparse_matrix<int> sp(N, 4);
+  TEST_ASSERT_EQUAL(0U, sp.tile_count());
+
+  // Reading through a const ref must not create tiles
+  const auto& csp = sp;
+  TEST_ASSERT_EQUAL(0, csp(3, 7));
+  TEST_ASSERT_EQUAL(0U, sp.tile_count());
+
+  sp(3, 7) = 5;
+  sp(30, 1) = 6;
+  sp(0, 0) = 7;
+  TEST_ASSERT_EQUAL(3U, sp.tile_count());
+  TEST_ASSERT_EQUAL(5, csp(3, 7));
+  TEST_ASSERT_EQUAL(6, csp(30, 1));
+  TEST_ASSERT_EQUAL(7, csp(0, 0));
+  TEST_ASSERT_EQUAL(0, csp(2, 7));
+
+  // Keys must stay sorted
+  for (auto t: range(sp.tile_count() - 1))
+    if (sp.tile_key(t) >= sp.tile_key(t+1)) {
+      std::cerr << "FAIL! Tile keys out of order" << std::endl;
+      return false;
+    }
+
+  sp(30, 1) = 0;
+  sp.prune();
+  TEST_ASSERT_EQUAL(2U, sp.tile_count());
+  TEST_ASSERT_EQUAL(5, csp(3, 7));
+  return true;
+}
+
+bool test_from_dense() {
+  const int N = 64;
+  auto dense = make_corners(N);
+  auto sp = morton::sparse_matrix<int>::from_dense(dense, 8);
+  // (0,0) and (1,2) share a tile; the other two are in the last tile
+  TEST_ASSERT_EQUAL(2U, sp.tile_count());
+  TEST_ASSERT_EQUAL(2 * 64U, sp.stored_size());
+
+  for (auto i: range(N))
+    for (auto j: range(N))
+      TEST_ASSERT_EQUAL(dense(i, j), sp(i, j));
+
+  auto back = sp.to_dense();
+  for (auto z: range(N*N))
+    TEST_ASSERT_EQUAL(dense.data()[z], back.data()[z]);
+  return true;
+}
+
+bool test_iter() {
+  const int N = 16;
+  auto sp = morton::sparse_matrix<int>::from_dense(make_corners(N), 2);
+  const auto& csp = sp;
+
+  int nonzero = 0;
+  uint64_t last_z = 0;
+  bool first = true;
+  for (auto it = csp.begin(); it != csp.end(); ++it) {
+    if (!first && it.z() <= last_z) {
+      std::cerr << "FAIL! Iteration not in Morton order" << std::endl;
+      return false;
+    }
+    first = false;
+    last_z = it.z();
+    TEST_ASSERT_EQUAL(csp(it.x(), it.y()), *it);
+    if (*it)
+      ++nonzero;
+  }
+  TEST_ASSERT_EQUAL(4, nonzero);
+
+  // Mutable iteration
+  for (auto it = sp.begin(); it != sp.end(); ++it)
+    *it += 1;
+  TEST_ASSERT_EQUAL(2, csp(0, 0));
+  TEST_ASSERT_EQUAL(0, csp(8, 8));
+  return true;
+}
+
+bool test_multiply() {
+  const int N = 64;
+  auto dense = make_corners(N);
+  // Fill a band so more than a couple of tiles are involved
+  for (auto i: range(N))
+    dense(i, i) = i + 1;
+  auto sp = morton::sparse_matrix<int>::from_dense(dense, 4);
+
+  std::vector<int> x(N);
+  for (auto i: range(N))
+    x[i] = i % 7 - 3;
+
+  auto y = sp * x;
+  for (auto i: range(N)) {
+    int expect = 0;
+    for (auto j: range(N))
+      expect += dense(i, j) * x[j];
+    TEST_ASSERT_EQUAL(expect, y[i]);
+  }
+  return true;
+}
+
+int main() {
+  static_assert(!std::is_copy_constructible<morton::sparse_matrix<char>>::value,
+		"Require that sparse matrix is not copyable");
+  RUN_TEST(test_element_access);
+  RUN_TEST(test_from_dense);
+  RUN_TEST(test_iter);
+  RUN_TEST(test_multiply);
+  return 0;
+}
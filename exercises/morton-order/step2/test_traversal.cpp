@@ -0,0 +1,123 @@
+#include <vector>
+
+#include "matrix.hpp"
+#include "traversal.hpp"
+#include "test.hpp"
+#include "range.hpp"
+
+morton::matrix<int> make_filled(int N) {
+  morton::matrix<int> mat(N);
+  for (auto i: range(N))
+    for (auto j: range(N))
+      mat(i, j) = i*N + j;
+  return mat;
+}
+
+// Prefetching iterators must visit the same things as plain ones
+bool test_prefetch_iter() {
+  const int N = 16;
+  auto mat = make_filled(N);
+  auto plain = mat.begin();
+  auto pf = mat.begin<morton::prefetch<8>>();
+  for (; pf != mat.end<morton::prefetch<8>>(); ++pf, ++plain) {
+    TEST_ASSERT_EQUAL(*plain, *pf);
+    TEST_ASSERT_EQUAL(plain.x(), pf.x());
+    TEST_ASSERT_EQUAL(plain.y(), pf.y());
+  }
+  if (plain != mat.end()) {
+    std::cerr << "plain iterator not at end" << std::endl;
+    return false;
+  }
+
+  const auto& cmat = mat;
+  auto cit = cmat.end<morton::prefetch<4, 0>>();
+  int count = 0;
+  while (cit != cmat.begin<morton::prefetch<4, 0>>()) {
+    --cit;
+    ++count;
+  }
+  TEST_ASSERT_EQUAL(N*N, count);
+  return true;
+}
+
+template<class Prefetch>
+bool check_row_major() {
+  const int N = 32;
+  const auto mat = make_filled(N);
+  int expect = 0;
+  morton::for_each_row_major<Prefetch>(mat, [&](uint32_t i, uint32_t j, const int& v) {
+      if (v != expect || int(i*N + j) != expect)
+	expect = -1000000;
+      ++expect;
+    });
+  TEST_ASSERT_EQUAL(N*N, expect);
+  return true;
+}
+
+bool test_row_major() {
+  // Including distances longer than a row and than the matrix
+  return check_row_major<morton::no_prefetch>() &&
+    check_row_major<morton::prefetch<5>>() &&
+    check_row_major<morton::prefetch<40>>() &&
+    check_row_major<morton::prefetch<5000>>();
+}
+
+bool test_row_major_write() {
+  const int N = 8;
+  morton::matrix<int> mat(N);
+  morton::for_each_row_major<morton::prefetch<3>>(mat, [](uint32_t i, uint32_t j, int& v) {
+      v = i - j;
+    });
+  for (auto i: range(N))
+    for (auto j: range(N))
+      TEST_ASSERT_EQUAL(int(i) - int(j), mat(i, j));
+  return true;
+}
+
+bool test_quadrants() {
+  const int N = 32;
+  const auto mat = make_filled(N);
+  for (auto order: {morton::quadrant_order::z, morton::quadrant_order::gray}) {
+    std::vector<int> seen(64, 0);
+    int last_qi = -1, last_qj = -1;
+    bool one_coord = true;
+    morton::for_each_quadrant<morton::prefetch<2>>(mat, 3, order,
+      [&](const int* q, uint32_t qrank, uint32_t qi, uint32_t qj) {
+	seen[qi * 8 + qj]++;
+	// First element of the quadrant is its top left corner
+	if (q[0] != int(qi * qrank * N + qj * qrank) || qrank != 4)
+	  seen[qi * 8 + qj] += 100;
+	if (last_qi >= 0 && int(qi) != last_qi && int(qj) != last_qj)
+	  one_coord = false;
+	last_qi = qi;
+	last_qj = qj;
+      });
+    for (auto s: seen)
+      TEST_ASSERT_EQUAL(1, s);
+    // Gray order only ever changes one coordinate at a time
+    if (order == morton::quadrant_order::gray)
+      TEST_ASSERT_EQUAL(true, one_coord);
+  }
+  return true;
+}
+
+// A default constructed matrix has rank 0, and nothing to visit
+bool test_empty() {
+  morton::matrix<double> m;
+  int calls = 0;
+  morton::for_each_row_major(m, [&](uint32_t, uint32_t, double&) { ++calls; });
+  morton::for_each_row_major<morton::prefetch<8>>(m, [&](uint32_t, uint32_t, double&) { ++calls; });
+  morton::for_each_quadrant(m, 2, morton::quadrant_order::gray,
+			    [&](double*, uint32_t, uint32_t, uint32_t) { ++calls; });
+  TEST_ASSERT_EQUAL(0, calls);
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_prefetch_iter);
+  RUN_TEST(test_row_major);
+  RUN_TEST(test_row_major_write);
+  RUN_TEST(test_quadrants);
+  RUN_TEST(test_empty);
+  return 0;
+}
@@ -0,0 +1,229 @@
+#ifndef MORTON_TRACKED_MATRIX_HPP
+#define MORTON_TRACKED_MATRIX_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <vector>
+#include "bits.hpp"
+#include "matrix.hpp"
+
+namespace morton {
+  // A Morton order matrix that records which quadrants have been
+  // written to, for incremental checkpointing (see checkpoint.hpp).
+  //
+  // The matrix is split into the 4^level quadrants at the chosen level
+  // of the quadtree, with one dirty flag each. Mutable element access
+  // and mutable iterators hand out a proxy reference, which only sets
+  // the flag when it is assigned to, so reading through them doesn't
+  // make a quadrant dirty.
+  //
+  // This is a separate class, like cow_matrix, so that element access
+  // on a plain matrix stays a branch-free load or store.
+  //
+  // NB:
+  //
+  //  - writes through the raw data pointer are not seen, so use
+  //    mark_dirty or mark_all_dirty for those
+  //
+  //  - the flags are plain bytes, so two threads must not write to the
+  //    same quadrant at once (which would be a race on the data anyway)
+  template<class T>
+  class tracked_matrix {
+  public:
+    // Proxy for a mutable element
+    class reference {
+    public:
+      operator const T&() const {
+	return _m->_data.data()[_z];
+      }
+      reference& operator=(const T& v) {
+	_m->touch(_z);
+	_m->_data.data()[_z] = v;
+	return *this;
+      }
+      reference& operator=(const reference& other) {
+	return *this = static_cast<const T&>(other);
+      }
+      reference& operator+=(const T& v) {
+	return *this = *this + v;
+      }
+      reference& operator-=(const T& v) {
+	return *this = *this - v;
+      }
+      reference& operator*=(const T& v) {
+	return *this = *this * v;
+      }
+      reference& operator/=(const T& v) {
+	return *this = *this / v;
+      }
+
+    private:
+      reference(tracked_matrix* m, uint64_t z) : _m(m), _z(z) {
+      }
+      friend tracked_matrix;
+
+      tracked_matrix* _m;
+      uint64_t _z;
+    };
+
+    // Bidirectional iterator over the elements in memory order, giving
+    // proxy references
+    class iterator :
+      public std::iterator<std::bidirectional_iterator_tag,
+			   T, int64_t, void, reference> {
+    public:
+      iterator() : _m(nullptr), _z(0) {
+      }
+
+      uint32_t x() const {
+	return pack(_z);
+      }
+      uint32_t y() const {
+	return pack(_z >> 1);
+      }
+
+      friend bool operator==(const iterator& a, const iterator& b) {
+	return a._z == b._z;
+      }
+      friend bool operator!=(const iterator& a, const iterator& b) {
+	return !(a == b);
+      }
+
+      reference operator*() const {
+	return reference(_m, _z);
+      }
+
+      iterator& operator++() {
+	++_z;
+	return *this;
+      }
+      iterator& operator--() {
+	--_z;
+	return *this;
+      }
+
+    private:
+      iterator(tracked_matrix* m, uint64_t z) : _m(m), _z(z) {
+      }
+      friend tracked_matrix;
+
+      tracked_matrix* _m;
+      uint64_t _z;
+    };
+
+    using const_iterator = typename matrix<T>::const_iterator;
+
+    tracked_matrix() : _shift(0) {
+    }
+
+    tracked_matrix(uint32_t r, uint32_t level = 2) : tracked_matrix(matrix<T>(r), level) {
+    }
+
+    // Take over a normal matrix. All quadrants start clean.
+    tracked_matrix(matrix<T>&& m, uint32_t level = 2) : _data(std::move(m)), _shift(0) {
+      // Can't have quadrants smaller than a single element
+      while (level > 0 && (_data.rank() >> level) == 0)
+	--level;
+      const uint32_t qrank = _data.rank() >> level;
+      while ((1U << _shift) < qrank)
+	++_shift;
+      _shift *= 2;
+      _dirty.assign(uint64_t(1) << (2*level), 0);
+    }
+
+    tracked_matrix(const tracked_matrix& other) = delete;
+    tracked_matrix& operator=(const tracked_matrix& other) = delete;
+    tracked_matrix(tracked_matrix&& other) noexcept = default;
+    tracked_matrix& operator=(tracked_matrix&& other) noexcept = default;
+    ~tracked_matrix() = default;
+
+    uint32_t rank() const {
+      return _data.rank();
+    }
+    uint64_t size() const {
+      return _data.size();
+    }
+
+    // The underlying matrix, read only
+    const matrix<T>& base() const {
+      return _data;
+    }
+
+    // Const element access
+    const T& operator()(uint32_t i, uint32_t j) const {
+      return _data(i, j);
+    }
+
+    // Mutable element access
+    reference operator()(uint32_t i, uint32_t j) {
+      return reference(this, encode(i, j));
+    }
+
+    // Raw data access - writes through the mutable pointer are not
+    // tracked
+    const T* data() const {
+      return _data.data();
+    }
+    T* data() {
+      return _data.data();
+    }
+
+    iterator begin() {
+      return iterator(this, 0);
+    }
+    iterator end() {
+      return iterator(this, size());
+    }
+    const_iterator begin() const {
+      return _data.begin();
+    }
+    const_iterator end() const {
+      return _data.end();
+    }
+
+    // Number of tracked quadrants and elements in each
+    uint64_t quadrant_count() const {
+      return _dirty.size();
+    }
+    uint64_t quadrant_size() const {
+      return uint64_t(1) << _shift;
+    }
+
+    bool is_dirty(uint64_t q) const {
+      return _dirty[q];
+    }
+    // Indices of the dirty quadrants, in Morton (i.e. memory) order
+    std::vector<uint64_t> dirty_quadrants() const {
+      std::vector<uint64_t> ans;
+      for (uint64_t q = 0; q < _dirty.size(); ++q)
+	if (_dirty[q])
+	  ans.push_back(q);
+      return ans;
+    }
+
+    // For writes the matrix can't see
+    void mark_dirty(uint32_t i, uint32_t j) {
+      touch(encode(i, j));
+    }
+    void mark_all_dirty() {
+      std::fill(_dirty.begin(), _dirty.end(), 1);
+    }
+    // Call after writing a checkpoint
+    void clear_dirty() {
+      std::fill(_dirty.begin(), _dirty.end(), 0);
+    }
+
+  private:
+    void touch(uint64_t z) {
+      _dirty[z >> _shift] = 1;
+    }
+
+    matrix<T> _data;
+    // One flag per quadrant
+    std::vector<uint8_t> _dirty;
+    // 2*log2(quadrant rank) - number of Morton bits within a quadrant
+    uint32_t _shift;
+  };
+}
+#endif
@@ -0,0 +1,106 @@
+#ifndef MORTON_TRAVERSAL_HPP
+#define MORTON_TRAVERSAL_HPP
+
+#include <cstdint>
+#include "bits.hpp"
+#include "prefetch.hpp"
+
+// Helpers for walking over a morton::matrix (or anything else with
+// rank() and contiguous data(), e.g. a tracked_matrix) in orders other
+// than the storage order, with an optional prefetch policy from
+// prefetch.hpp. A cow_matrix has no single data() so can't be used.
+//
+// Writes through these go straight to the data, so aren't seen by a
+// tracked_matrix - use its mark_dirty.
+namespace morton {
+
+  // Visit every element in row-major order (i outer, j inner),
+  // calling f(i, j, element).
+  //
+  // In Morton order, stepping along a row is a jump in memory at the
+  // end of every Z run, which the hardware prefetcher can't predict.
+  // With a prefetch policy we prefetch the element distance steps
+  // ahead in the traversal, which we compute with the same Morton
+  // arithmetic, so it lands exactly on the target of each jump,
+  // including across the end of the row.
+  template<class Prefetch = no_prefetch, class M, class F>
+  void for_each_row_major(M& mat, F f) {
+    const uint32_t n = mat.rank();
+    if (n == 0)
+      return;
+    auto data = mat.data();
+    const uint32_t dist = Prefetch::distance;
+
+    // Position of the element being prefetched
+    uint32_t pi = dist / n, pj = dist % n;
+    uint64_t pz = encode(pi, pj);
+
+    for (uint32_t i = 0; i < n; ++i) {
+      uint64_t z = encode(i, 0);
+      for (uint32_t j = 0; j < n; ++j) {
+	if (dist) {
+	  if (pi < n)
+	    Prefetch::fetch(ahead(data, pz));
+	  if (++pj == n) {
+	    pj = 0;
+	    pz = encode(++pi, 0);
+	  } else {
+	    pz = inc_y(pz);
+	  }
+	}
+	f(i, j, data[z]);
+	z = inc_y(z);
+      }
+    }
+  }
+
+  // Order to visit the quadrants in.
+  //
+  // z: storage order.
+  //
+  // gray: the k'th quadrant visited is the one with Morton index
+  // k ^ (k >> 1), the Gray code of k. Successive quadrants then
+  // differ in only one bit of their index, i.e. one of their
+  // coordinates, like a Hilbert curve, rather than the long diagonal
+  // jumps Z order makes at the end of each row of a block.
+  enum class quadrant_order { z, gray };
+
+  // Visit the 4^level quadrants of the matrix, calling
+  // f(quad_data, quad_rank, qi, qj) where (qi, qj) is the quadrant's
+  // position in the grid of quadrants and its data is contiguous and
+  // in Morton order.
+  //
+  // The prefetch distance here is the number of cache lines at the
+  // start of the next quadrant to fetch before starting this one, as
+  // the jump between quadrants is where the hardware gets it wrong.
+  template<class Prefetch = no_prefetch, class M, class F>
+  void for_each_quadrant(M& mat, uint32_t level, quadrant_order order, F f) {
+    const uint32_t n = mat.rank();
+    if (n == 0)
+      return;
+    while (level > 0 && (n >> level) == 0)
+      --level;
+    const uint32_t qrank = n >> level;
+    const uint64_t qsize = uint64_t(qrank) * qrank;
+    const uint64_t nq = uint64_t(1) << (2*level);
+    auto data = mat.data();
+
+    auto quad = [order](uint64_t k) {
+      return order == quadrant_order::gray ? k ^ (k >> 1) : k;
+    };
+    const std::ptrdiff_t line = 64 / sizeof(*data) ? 64 / sizeof(*data) : 1;
+
+    for (uint64_t k = 0; k < nq; ++k) {
+      const uint64_t q = quad(k);
+      if (Prefetch::distance && k + 1 < nq) {
+	const auto next = data + quad(k + 1) * qsize;
+	for (int l = 0; l < Prefetch::distance; ++l)
+	  Prefetch::fetch(ahead(next, l * line));
+      }
+      uint32_t qi, qj;
+      decode(q, qi, qj);
+      f(data + q * qsize, qrank, qi, qj);
+    }
+  }
+}
+#endif
@@ -1,3 +1,4 @@
+#include <tuple>
 #include <vector>
 #include "bits.hpp"
 #include "test.hpp"
@@ -76,6 +77,37 @@ bool test_encode() {
   return true;
 }
 
+const std::vector<std::tuple<uint32_t, uint32_t, uint32_t, uint64_t>> enc3_data = {
+  {0, 0, 0, 0},
+  {1, 0, 0, 1},
+  {0, 1, 0, 2},
+  {0, 0, 1, 4},
+  {1, 1, 1, 7},
+  {2, 0, 0, 8},
+  {3, 5, 6, 0x1ab},
+  {0x1fffffU, 0x1fffffU, 0x1fffffU, 0x7fffffffffffffffUL},
+  {0x1fffffU, 0, 0, 0x1249249249249249UL}
+};
+
+bool test_encode3() {
+  for (auto& item: enc3_data) {
+    auto& x = std::get<0>(item);
+    auto& y = std::get<1>(item);
+    auto& z = std::get<2>(item);
+    auto& m = std::get<3>(item);
+
+    auto res = encode(x, y, z);
+    TEST_ASSERT_EQUAL(m, res);
+
+    uint32_t rx, ry, rz;
+    decode(m, rx, ry, rz);
+    TEST_ASSERT_EQUAL(x, rx);
+    TEST_ASSERT_EQUAL(y, ry);
+    TEST_ASSERT_EQUAL(z, rz);
+  }
+  return true;
+}
+
 bool test_shift() {
   uint64_t start = 0;
   auto res = dec_y(dec_x(inc_y(inc_x(start))));
@@ -87,6 +119,7 @@ int main() {
   RUN_TEST(test_split);
   RUN_TEST(test_pack);
   RUN_TEST(test_encode);
+  RUN_TEST(test_encode3);
   RUN_TEST(test_shift);
   return 0;
 }
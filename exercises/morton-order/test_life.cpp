@@ -0,0 +1,119 @@
+#include <vector>
+#include "life.hpp"
+#include "test.hpp"
+
+using namespace morton;
+
+// Straightforward reference implementation on a row-major grid
+struct naive_life {
+  int n;
+  std::vector<char> cells;
+
+  naive_life(int size) : n(size), cells(size * size, 0) {
+  }
+  char get(int x, int y) const {
+    if (x < 0 || y < 0 || x >= n || y >= n)
+      return 0;
+    return cells[y * n + x];
+  }
+  void step() {
+    std::vector<char> next(cells.size());
+    for (int y = 0; y < n; ++y)
+      for (int x = 0; x < n; ++x) {
+	int count = 0;
+	for (int dy = -1; dy <= 1; ++dy)
+	  for (int dx = -1; dx <= 1; ++dx)
+	    if (dx || dy)
+	      count += get(x + dx, y + dy);
+	next[y * n + x] = count == 3 || (count == 2 && get(x, y));
+      }
+    cells.swap(next);
+  }
+};
+
+bool same(const life_grid& grid, const naive_life& ref) {
+  for (int y = 0; y < ref.n; ++y)
+    for (int x = 0; x < ref.n; ++x)
+      if (grid.get(x, y) != bool(ref.get(x, y))) {
+	std::cerr << "FAIL! Mismatch at (" << x << ", " << y << ") in generation "
+		  << grid.generation() << std::endl;
+	return false;
+      }
+  return true;
+}
+
+bool test_random() {
+  for (unsigned nthreads: {1U, 3U}) {
+    life_grid grid(16);
+    naive_life ref(grid.size());
+    // Fill a blob in the middle, crossing lots of tile edges, and leave
+    // the rest empty so the skipping gets exercised.
+    uint64_t state = 12345;
+    for (int y = 30; y < 100; ++y)
+      for (int x = 20; x < 90; ++x) {
+	state = state * 6364136223846793005UL + 1442695040888963407UL;
+	bool alive = (state >> 60) < 6;
+	grid.set(x, y, alive);
+	ref.cells[y * ref.n + x] = alive;
+      }
+    for (int gen = 0; gen < 60; ++gen) {
+      if (!same(grid, ref))
+	return false;
+      grid.step(nthreads);
+      ref.step();
+    }
+  }
+  return true;
+}
+
+bool test_patterns() {
+  life_grid grid(4);
+  // Blinker straddling a tile boundary
+  grid.set(7, 3, true);
+  grid.set(8, 3, true);
+  grid.set(9, 3, true);
+  // Block (still life) in the corner
+  grid.set(30, 30, true);
+  grid.set(31, 30, true);
+  grid.set(30, 31, true);
+  grid.set(31, 31, true);
+
+  TEST_ASSERT_EQUAL(7U, grid.population());
+  grid.step();
+  TEST_ASSERT_EQUAL(true, grid.get(8, 2));
+  TEST_ASSERT_EQUAL(true, grid.get(8, 4));
+  TEST_ASSERT_EQUAL(false, grid.get(7, 3));
+  grid.step();
+  TEST_ASSERT_EQUAL(true, grid.get(7, 3));
+  TEST_ASSERT_EQUAL(7U, grid.population());
+  // Only the blinker's tiles keep changing
+  TEST_ASSERT_EQUAL(2U, grid.active_tiles());
+  return true;
+}
+
+bool test_glider() {
+  life_grid grid(4);
+  // Glider heading towards +x, +y
+  grid.set(1, 0, true);
+  grid.set(2, 1, true);
+  grid.set(0, 2, true);
+  grid.set(1, 2, true);
+  grid.set(2, 2, true);
+  // Every 4 generations it moves one cell diagonally
+  for (int i = 0; i < 40; ++i)
+    grid.step();
+  TEST_ASSERT_EQUAL(5U, grid.population());
+  TEST_ASSERT_EQUAL(true, grid.get(11, 10));
+  TEST_ASSERT_EQUAL(true, grid.get(12, 11));
+  TEST_ASSERT_EQUAL(true, grid.get(10, 12));
+  TEST_ASSERT_EQUAL(true, grid.get(11, 12));
+  TEST_ASSERT_EQUAL(true, grid.get(12, 12));
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_random);
+  RUN_TEST(test_patterns);
+  RUN_TEST(test_glider);
+  return 0;
+}
@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <vector>
+#include "linear_tree.hpp"
+#include "test.hpp"
+
+using namespace morton;
+
+// Simple reproducible pseudo-random numbers in [0, 1)
+struct lcg {
+  uint64_t state;
+  double operator()() {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    return double(state >> 11) / double(1UL << 53);
+  }
+};
+
+template<int D>
+std::vector<typename point_set<D>::point> make_points(std::size_t n, uint64_t seed) {
+  lcg rng{seed};
+  std::vector<typename point_set<D>::point> pts(n);
+  for (auto& p: pts)
+    for (int d = 0; d < D; ++d)
+      p[d] = rng();
+  return pts;
+}
+
+// Check tree queries against brute force, comparing by id
+template<int D>
+bool check_queries(const linear_tree<D>& tree, uint64_t seed) {
+  using point = typename point_set<D>::point;
+  auto& pts = tree.points();
+  lcg rng{seed};
+
+  for (int q = 0; q < 20; ++q) {
+    point lo, hi;
+    for (int d = 0; d < D; ++d) {
+      auto a = rng(), b = rng();
+      lo[d] = std::min(a, b);
+      hi[d] = std::max(a, b);
+    }
+    auto found = tree.box_query(lo, hi);
+    std::vector<uint32_t> got, expect;
+    for (auto i: found)
+      got.push_back(tree.ids()[i]);
+    for (std::size_t i = 0; i < pts.size(); ++i) {
+      bool in = true;
+      for (int d = 0; d < D; ++d)
+	in = in && lo[d] <= pts[i][d] && pts[i][d] <= hi[d];
+      if (in)
+	expect.push_back(tree.ids()[i]);
+    }
+    std::sort(got.begin(), got.end());
+    std::sort(expect.begin(), expect.end());
+    TEST_ASSERT_EQUAL(expect.size(), got.size());
+    for (std::size_t i = 0; i < got.size(); ++i)
+      TEST_ASSERT_EQUAL(expect[i], got[i]);
+  }
+
+  for (int q = 0; q < 20; ++q) {
+    point c;
+    for (int d = 0; d < D; ++d)
+      c[d] = 1.2 * rng() - 0.1;
+    const std::size_t k = 7;
+    auto near = tree.knn(c, k);
+
+    std::vector<std::pair<double, std::size_t>> all;
+    for (std::size_t i = 0; i < pts.size(); ++i) {
+      double d2 = 0;
+      for (int d = 0; d < D; ++d)
+	d2 += (pts[i][d] - c[d]) * (pts[i][d] - c[d]);
+      all.push_back({d2, i});
+    }
+    std::sort(all.begin(), all.end());
+    TEST_ASSERT_EQUAL(k, near.size());
+    for (std::size_t i = 0; i < k; ++i) {
+      double d2 = 0;
+      for (int d = 0; d < D; ++d)
+	d2 += (pts[near[i]][d] - c[d]) * (pts[near[i]][d] - c[d]);
+      TEST_ASSERT_EQUAL(all[i].first, d2);
+    }
+  }
+  return true;
+}
+
+template<int D>
+bool check_tree() {
+  point_set<D> ps(make_points<D>(20000, D), 2);
+  linear_tree<D> tree(ps, 0, 2);
+
+  // Each level's boundaries split the keys into runs of equal prefix,
+  // and contain the previous level's
+  for (unsigned l = 1; l <= tree.max_level(); ++l) {
+    auto& coarse = tree.level(l - 1);
+    auto& fine = tree.level(l);
+    if (!std::includes(fine.begin(), fine.end(), coarse.begin(), coarse.end())) {
+      std::cerr << "FAIL! Level " << l << " does not refine level " << l-1 << std::endl;
+      return false;
+    }
+  }
+  if (!check_queries(tree, 11))
+    return false;
+
+  // Batched updates
+  auto extra = make_points<D>(3000, 99);
+  auto new_ids = tree.insert(extra, 2);
+  TEST_ASSERT_EQUAL(23000U, tree.size());
+  TEST_ASSERT_EQUAL(20000U, new_ids.front());
+  for (std::size_t i = 1; i < tree.size(); ++i)
+    if (tree.keys()[i] < tree.keys()[i-1]) {
+      std::cerr << "FAIL! Keys unsorted after insert" << std::endl;
+      return false;
+    }
+  if (!check_queries(tree, 12))
+    return false;
+
+  std::vector<uint32_t> remove;
+  for (uint32_t id = 0; id < 23000; id += 3)
+    remove.push_back(id);
+  tree.erase(remove);
+  TEST_ASSERT_EQUAL(23000U - remove.size(), tree.size());
+  for (auto id: tree.ids())
+    if (id % 3 == 0) {
+      std::cerr << "FAIL! Erased id " << id << " still present" << std::endl;
+      return false;
+    }
+  return check_queries(tree, 13);
+}
+
+// Points inserted outside the box the tree was built over
+bool test_outside() {
+  using point = point_set<2>::point;
+  point_set<2> ps(make_points<2>(1000, 5), 2);
+  linear_tree<2> tree(ps, 0, 2);
+  auto ids = tree.insert({point{{5.0, 5.0}}, point{{-3.0, 0.5}}}, 2);
+
+  auto found = tree.box_query(point{{4.0, 4.0}}, point{{6.0, 6.0}});
+  TEST_ASSERT_EQUAL(1U, found.size());
+  TEST_ASSERT_EQUAL(ids[0], tree.ids()[found[0]]);
+  found = tree.box_query(point{{-4.0, 0.0}}, point{{-2.0, 1.0}});
+  TEST_ASSERT_EQUAL(1U, found.size());
+  TEST_ASSERT_EQUAL(ids[1], tree.ids()[found[0]]);
+  // A box holding everything but the outside points
+  found = tree.box_query(point{{0.0, 0.0}}, point{{1.0, 1.0}});
+  TEST_ASSERT_EQUAL(1000U, found.size());
+
+  auto near = tree.knn(point{{4.9, 4.9}}, 1);
+  TEST_ASSERT_EQUAL(ids[0], tree.ids()[near[0]]);
+  return check_queries(tree, 14);
+}
+
+bool test_quadtree() {
+  return check_tree<2>();
+}
+
+bool test_octree() {
+  return check_tree<3>();
+}
+
+int main() {
+  RUN_TEST(test_quadtree);
+  RUN_TEST(test_octree);
+  RUN_TEST(test_outside);
+  return 0;
+}
@@ -0,0 +1,223 @@
+#include <cmath>
+#include <set>
+#include <vector>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "partition.hpp"
+#include "point_set.hpp"
+#include "test.hpp"
+
+using namespace morton;
+
+// Simple reproducible pseudo-random numbers in [0, 1)
+struct lcg {
+  uint64_t state;
+  double operator()() {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    return double(state >> 11) / double(1UL << 53);
+  }
+};
+
+// Weights for a rank x rank grid in Morton order, heavy in one corner
+std::vector<double> make_weights(uint32_t rank) {
+  std::vector<double> w(uint64_t(rank) * rank);
+  for (uint64_t z = 0; z < w.size(); ++z) {
+    uint32_t i, j;
+    decode(z, i, j);
+    w[z] = (i < rank / 4 && j < rank / 4) ? 10.0 : 1.0;
+  }
+  return w;
+}
+
+bool test_cuts() {
+  const uint32_t rank = 256;
+  auto w = make_weights(rank);
+  double total = 0;
+  for (auto x: w)
+    total += x;
+
+  for (unsigned P: {1U, 3U, 7U, 64U}) {
+    auto cuts = partition_cuts(w.data(), w.size(), P, 1);
+    TEST_ASSERT_EQUAL(P + 1, cuts.size());
+    TEST_ASSERT_EQUAL(0U, cuts.front());
+    TEST_ASSERT_EQUAL(w.size(), cuts.back());
+    for (unsigned p = 0; p < P; ++p) {
+      double part = 0;
+      for (auto z = cuts[p]; z < cuts[p + 1]; ++z)
+	part += w[z];
+      // Can't be more than one element's weight from the target
+      if (std::abs(part - total / P) > 10.0 + 1e-9) {
+	std::cerr << "FAIL! Part " << p << " of " << P << " has weight " << part
+		  << ", wanted " << total / P << std::endl;
+	return false;
+      }
+    }
+    // Threading mustn't change the answer
+    auto par_cuts = partition_cuts(w.data(), w.size(), P, 4);
+    for (unsigned p = 0; p <= P; ++p)
+      TEST_ASSERT_EQUAL(cuts[p], par_cuts[p]);
+  }
+  return true;
+}
+
+// Brute force halo of the cells owned by p, from an owner array
+std::vector<uint64_t> brute_halo(const int* owner, uint32_t rank, int p) {
+  std::set<uint64_t> halo;
+  for (uint32_t i = 0; i < rank; ++i)
+    for (uint32_t j = 0; j < rank; ++j) {
+      if (owner[encode(i, j)] != p)
+	continue;
+      for (int di = -1; di <= 1; ++di)
+	for (int dj = -1; dj <= 1; ++dj) {
+	  int ni = int(i) + di, nj = int(j) + dj;
+	  if (ni < 0 || nj < 0 || ni >= int(rank) || nj >= int(rank))
+	    continue;
+	  auto nz = encode(ni, nj);
+	  if (owner[nz] != p)
+	    halo.insert(nz);
+	}
+    }
+  return std::vector<uint64_t>(halo.begin(), halo.end());
+}
+
+std::vector<uint64_t> expand(const std::vector<z_run>& runs) {
+  std::vector<uint64_t> ans;
+  for (auto& r: runs)
+    for (auto z = r.begin; z < r.end; ++z)
+      ans.push_back(z);
+  return ans;
+}
+
+bool test_halo() {
+  const uint32_t rank = 32;
+  const unsigned P = 5;
+  auto cuts = partition_cuts(uint64_t(rank) * rank, P);
+  std::vector<int> owner(rank * rank);
+  for (unsigned p = 0; p < P; ++p)
+    for (auto z = cuts[p]; z < cuts[p + 1]; ++z)
+      owner[z] = p;
+
+  for (unsigned p = 0; p < P; ++p) {
+    auto runs = halo_runs(rank, cuts[p], cuts[p + 1]);
+    auto got = expand(runs);
+    auto expect = brute_halo(owner.data(), rank, p);
+    TEST_ASSERT_EQUAL(expect.size(), got.size());
+    for (std::size_t k = 0; k < got.size(); ++k)
+      TEST_ASSERT_EQUAL(expect[k], got[k]);
+    // Runs are maximal
+    for (std::size_t k = 1; k < runs.size(); ++k)
+      if (runs[k].begin <= runs[k-1].end) {
+	std::cerr << "FAIL! Halo runs not merged" << std::endl;
+	return false;
+      }
+  }
+
+  // Just the edge neighbours for a single element
+  auto cross = expand(halo_runs(rank, encode(5, 5), encode(5, 5) + 1, false));
+  TEST_ASSERT_EQUAL(4U, cross.size());
+  return true;
+}
+
+// Stand-in for an MPI run: fork P processes that each work out their
+// own part and halo, and record them in shared memory for the parent
+// to check.
+bool test_multiprocess() {
+  const uint32_t rank = 128;
+  const unsigned P = 4;
+  const uint64_t n = uint64_t(rank) * rank;
+  // Per element: how many processes claimed it and which one.
+  // Then per process: its halo size.
+  const std::size_t bytes = (2 * n + P) * sizeof(int);
+  void* mem = mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+		   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED) {
+    std::cerr << "FAIL! mmap" << std::endl;
+    return false;
+  }
+  int* claims = static_cast<int*>(mem);
+  int* owner = claims + n;
+  int* halo_size = owner + n;
+
+  std::vector<pid_t> children;
+  for (unsigned p = 0; p < P; ++p) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      // Every process computes the same cuts independently
+      auto w = make_weights(rank);
+      auto cuts = partition_cuts(w.data(), n, P);
+      for (auto z = cuts[p]; z < cuts[p + 1]; ++z) {
+	__atomic_fetch_add(&claims[z], 1, __ATOMIC_RELAXED);
+	owner[z] = p;
+      }
+      halo_size[p] = expand(halo_runs(rank, cuts[p], cuts[p + 1])).size();
+      _exit(0);
+    }
+    children.push_back(pid);
+  }
+
+  bool ok = true;
+  for (auto pid: children) {
+    int status;
+    waitpid(pid, &status, 0);
+    ok = ok && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+  }
+  for (uint64_t z = 0; z < n; ++z)
+    ok = ok && claims[z] == 1;
+  for (unsigned p = 0; ok && p < P; ++p)
+    ok = brute_halo(owner, rank, p).size() == std::size_t(halo_size[p]);
+  munmap(mem, bytes);
+  if (!ok)
+    std::cerr << "FAIL! Processes disagree on the decomposition" << std::endl;
+  return ok;
+}
+
+bool test_point_halo() {
+  using pset = point_set<2>;
+  lcg rng{5};
+  std::vector<pset::point> pts(5000);
+  for (auto& p: pts)
+    p = {{rng(), rng()}};
+  pset ps(pts);
+
+  const unsigned P = 6, level = 5;
+  auto cuts = partition_cuts(ps.size(), P);
+  const unsigned shift = 2 * (32 - level);
+  // Width of a level 5 cell in coordinates
+  const double width = (ps.hi()[0] - ps.lo()[0]) / (1 << level);
+  const double height = (ps.hi()[1] - ps.lo()[1]) / (1 << level);
+  const double reach = 0.99 * std::min(width, height);
+
+  for (unsigned p = 0; p < P; ++p) {
+    auto runs = point_halo_runs(ps.keys(), cuts[p], cuts[p + 1], level);
+    auto in_halo = [&](uint64_t key) {
+      auto c = key >> shift;
+      for (auto& r: runs)
+	if (r.begin <= c && c < r.end)
+	  return true;
+      return false;
+    };
+    // Every other part's point near one of ours must be in the halo
+    for (uint64_t q = 0; q < ps.size(); ++q) {
+      if (q >= cuts[p] && q < cuts[p + 1])
+	continue;
+      for (auto k = cuts[p]; k < cuts[p + 1]; ++k) {
+	auto dx = ps[q][0] - ps[k][0], dy = ps[q][1] - ps[k][1];
+	if (dx*dx + dy*dy < reach*reach && !in_halo(ps.keys()[q])) {
+	  std::cerr << "FAIL! Point " << q << " missing from halo of part " << p << std::endl;
+	  return false;
+	}
+      }
+    }
+  }
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_cuts);
+  RUN_TEST(test_halo);
+  RUN_TEST(test_multiprocess);
+  RUN_TEST(test_point_halo);
+  return 0;
+}
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <vector>
+#include "point_set.hpp"
+#include "test.hpp"
+
+using namespace morton;
+
+// Simple reproducible pseudo-random numbers in [0, 1)
+struct lcg {
+  uint64_t state;
+  double operator()() {
+    state = state * 6364136223846793005UL + 1442695040888963407UL;
+    return double(state >> 11) / double(1UL << 53);
+  }
+};
+
+bool test_radix_sort() {
+  for (unsigned nthreads: {1U, 4U}) {
+    lcg rng{42};
+    const std::size_t n = 100000;
+    std::vector<uint64_t> keys(n);
+    for (auto& k: keys) {
+      k = uint64_t(rng() * 1e6);
+      if (k % 3 == 0)
+	k |= uint64_t(k) << 40;
+    }
+    auto orig = keys;
+
+    std::vector<uint32_t> perm;
+    radix_sort(keys, perm, nthreads);
+
+    auto expect = orig;
+    std::sort(expect.begin(), expect.end());
+    for (std::size_t i = 0; i < n; ++i) {
+      TEST_ASSERT_EQUAL(expect[i], keys[i]);
+      TEST_ASSERT_EQUAL(orig[perm[i]], keys[i]);
+    }
+    // Stable: equal keys keep their input order
+    for (std::size_t i = 1; i < n; ++i)
+      if (keys[i] == keys[i-1] && perm[i] < perm[i-1]) {
+	std::cerr << "FAIL! radix_sort is not stable" << std::endl;
+	return false;
+      }
+  }
+  return true;
+}
+
+template<int D, class Real = double>
+bool check_point_set(unsigned nthreads) {
+  using pset = point_set<D, Real>;
+  lcg rng{7};
+  const std::size_t n = 50000;
+  std::vector<typename pset::point> pts(n);
+  std::vector<std::size_t> ids(n);
+  for (std::size_t i = 0; i < n; ++i) {
+    for (int d = 0; d < D; ++d)
+      pts[i][d] = Real(10.0 * rng() - 3.0);
+    ids[i] = i;
+  }
+
+  pset ps(pts, nthreads);
+  TEST_ASSERT_EQUAL(n, ps.size());
+  auto sorted_ids = ps.reorder(ids, nthreads);
+  for (std::size_t k = 0; k < n; ++k) {
+    if (k && ps.keys()[k] < ps.keys()[k-1]) {
+      std::cerr << "FAIL! keys not sorted" << std::endl;
+      return false;
+    }
+    TEST_ASSERT_EQUAL(ps.key_of(ps[k]), ps.keys()[k]);
+    TEST_ASSERT_EQUAL(ps.permutation()[k], sorted_ids[k]);
+    for (int d = 0; d < D; ++d)
+      TEST_ASSERT_EQUAL(pts[sorted_ids[k]][d], ps[k][d]);
+  }
+  return true;
+}
+
+bool test_point_set_2d() {
+  return check_point_set<2>(1) && check_point_set<2>(3);
+}
+
+bool test_point_set_3d() {
+  return check_point_set<3>(1) && check_point_set<3>(3);
+}
+
+bool test_point_set_float() {
+  return check_point_set<2, float>(3) && check_point_set<3, float>(3);
+}
+
+bool test_cells() {
+  using pset = point_set<2>;
+  std::vector<pset::point> pts = {{{0.0, 0.0}}, {{1.0, 1.0}}, {{0.0, 1.0}}, {{1.0, 0.0}}};
+  pset ps(pts);
+  // Z order: (0,0), (1,0), (0,1), (1,1)
+  TEST_ASSERT_EQUAL(0U, ps.permutation()[0]);
+  TEST_ASSERT_EQUAL(3U, ps.permutation()[1]);
+  TEST_ASSERT_EQUAL(2U, ps.permutation()[2]);
+  TEST_ASSERT_EQUAL(1U, ps.permutation()[3]);
+  TEST_ASSERT_EQUAL(0xffffffffffffffffUL, ps.keys()[3]);
+  // Outside the box is clamped
+  TEST_ASSERT_EQUAL(0U, ps.key_of({{-5.0, -5.0}}));
+
+  // The top cell is still in range when Real can't represent it
+  using fset = point_set<2, float>;
+  fset fs(std::vector<fset::point>{{{0.0f, 0.0f}}, {{1.0f, 1.0f}}});
+  TEST_ASSERT_EQUAL(0xffffffffffffffffUL, fs.keys()[1]);
+  TEST_ASSERT_EQUAL(0xffffffffffffffffUL, fs.key_of({{7.0f, 7.0f}}));
+  return true;
+}
+
+int main() {
+  RUN_TEST(test_radix_sort);
+  RUN_TEST(test_point_set_2d);
+  RUN_TEST(test_point_set_3d);
+  RUN_TEST(test_point_set_float);
+  RUN_TEST(test_cells);
+  return 0;
+}
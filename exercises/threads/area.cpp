@@ -1,47 +1,456 @@
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <complex>
 #include <chrono>
+#include <memory>
+#include <vector>
+
+#include "image.hpp"
+#include "mandelbrot.hpp"
+#include "montecarlo.hpp"
+#include "perturbation.hpp"
+#include "profile.hpp"
+#include "progressive.hpp"
+#include "reduction.hpp"
+#include "subdivide.hpp"
+#include "thread_pool.hpp"
+#include "tile_cache.hpp"
 
 using complex = std::complex<double>;
 
-// Determine if a complex number is inside the set
-bool in_mandelbrot(const complex& c) {
-  const auto MAXITER = 2000;
-  auto z = c;
-  for (auto i = 0; i < MAXITER; ++i) {
-    z = z*z + c;
-    if (std::norm(z) > 4.0)
-      return false;
+// Settings from the command line
+struct options {
+  int npoints = 2000;
+  int maxiter = 2000;
+  // grid: iterate every point of the grid
+  // subdivide: rectangle subdivision, see subdivide.hpp
+  // progressive: double npoints until the error target is met, see
+  // progressive.hpp
+  // deepzoom: the square of side width around centre, by
+  // perturbation, see perturbation.hpp
+  // montecarlo: samples random points in each cell of the grid, see
+  // montecarlo.hpp
+  const char* mode = "grid";
+  double target = 0.0;
+  int maxpoints = 8000;
+  unsigned nthreads = 0;
+  // Rows near the edge of the set take far longer than the rest, so
+  // by default hand them out one at a time.
+  threads::schedule sched = threads::schedule::dynamic;
+  std::size_t chunk = 1;
+  threads::isa kernel = threads::best_isa();
+  bool interior = false;
+  // In a valley of the main cardioid, deep enough that plain doubles
+  // can't tell the grid points apart
+  threads::dd centre_re = threads::dd(-0.743643887037158704752191506114774);
+  threads::dd centre_im = threads::dd(0.131825904205311970493132056385139);
+  double width = 1e-14;
+  // grid: also write the escape counts to this .pgm or .png file,
+  // band rows at a time
+  const char* image = nullptr;
+  threads::image_format format = threads::image_format::pgm;
+  int band = 16;
+  // grid: directory of cached tiles of escape counts, its size limit
+  // and the tile size, see tile_cache.hpp
+  const char* cache = nullptr;
+  long cache_mb = 1024;
+  int tile = 64;
+  // grid: directory of cost profiles, see profile.hpp
+  const char* profile = nullptr;
+  int samples = 1;
+  unsigned long seed = 0;
+};
+
+void usage() {
+  std::printf("  Mandelbrot area options:\n");
+  std::printf("  -npoints <int>:   grid points along each side (default: 2000)\n");
+  std::printf("  -maxiter <int>:   iterations before a point counts as inside\n");
+  std::printf("                    (default: 2000)\n");
+  std::printf("  -mode <name>:     grid, subdivide, progressive, deepzoom or\n");
+  std::printf("                    montecarlo (default: grid)\n");
+  std::printf("  -target <float>:  progressive: stop when the change in area\n");
+  std::printf("                    between levels is below this (default: 0)\n");
+  std::printf("  -maxpoints <int>: progressive: largest npoints to go to\n");
+  std::printf("                    (default: 8000)\n");
+  std::printf("  -centre <re> <im>: deepzoom: centre of the view, to 32 digits\n");
+  std::printf("  -width <float>:   deepzoom: side of the view (default: 1e-14)\n");
+  std::printf("  -cache <dir>:     grid: reuse tiles of escape counts saved in dir\n");
+  std::printf("                    by earlier runs, and save new ones there\n");
+  std::printf("  -cache-size <MB>: size limit for the cache (default: 1024)\n");
+  std::printf("  -tile <int>:      points along each side of a cached tile, and\n");
+  std::printf("                    image rows at a time with -cache (default: 64)\n");
+  std::printf("  -profile <dir>:   grid: split the rows between threads by the cost\n");
+  std::printf("                    profile for this region in dir, or measure\n");
+  std::printf("                    and save one there if there isn't one yet\n");
+  std::printf("  -samples <int>:   montecarlo: random points per grid cell\n");
+  std::printf("                    (default: 1)\n");
+  std::printf("  -seed <int>:      montecarlo: random number seed (default: 0)\n");
+  std::printf("  -image <file>:    grid: write the escape count of every point\n");
+  std::printf("                    to a 16 bit .pgm or .png (if built with libpng)\n");
+  std::printf("  -band <int>:      image rows computed and written at a time\n");
+  std::printf("                    (default: 16)\n");
+  std::printf("  -threads <int>:   number of threads (default: all cores)\n");
+  std::printf("  -schedule <name>: static, dynamic or guided (default: dynamic)\n");
+  std::printf("  -chunk <int>:     rows per chunk; for static, 0 means one block\n");
+  std::printf("                    per thread (default: 1). With -image, bands\n");
+  std::printf("                    are always handed out one at a time\n");
+  std::printf("  -isa <name>:      kernel to use: scalar, avx2 or avx512\n");
+  std::printf("                    (default: the best this CPU supports)\n");
+  std::printf("  -interior:        skip points proven to be inside, with the\n");
+  std::printf("                    cardioid/bulb tests and periodicity checking\n");
+  std::printf("                    (default: off, i.e. brute force)\n");
+  std::exit(1);
+}
+
+options parse_args(int argc, char* argv[]) {
+  options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-npoints") == 0 && i + 1 < argc) {
+      opt.npoints = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-maxiter") == 0 && i + 1 < argc) {
+      opt.maxiter = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-mode") == 0 && i + 1 < argc) {
+      opt.mode = argv[++i];
+      if (std::strcmp(opt.mode, "grid") != 0 && std::strcmp(opt.mode, "subdivide") != 0 &&
+	  std::strcmp(opt.mode, "progressive") != 0 && std::strcmp(opt.mode, "deepzoom") != 0 &&
+	  std::strcmp(opt.mode, "montecarlo") != 0)
+	usage();
+    } else if (std::strcmp(argv[i], "-target") == 0 && i + 1 < argc) {
+      opt.target = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "-maxpoints") == 0 && i + 1 < argc) {
+      opt.maxpoints = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-centre") == 0 && i + 2 < argc) {
+      if (!threads::parse_dd(argv[++i], opt.centre_re) ||
+	  !threads::parse_dd(argv[++i], opt.centre_im))
+	usage();
+    } else if (std::strcmp(argv[i], "-width") == 0 && i + 1 < argc) {
+      opt.width = std::atof(argv[++i]);
+    } else if (std::strcmp(argv[i], "-cache") == 0 && i + 1 < argc) {
+      opt.cache = argv[++i];
+    } else if (std::strcmp(argv[i], "-cache-size") == 0 && i + 1 < argc) {
+      opt.cache_mb = std::atol(argv[++i]);
+    } else if (std::strcmp(argv[i], "-tile") == 0 && i + 1 < argc) {
+      opt.tile = std::atoi(argv[++i]);
+      if (opt.tile < 1)
+	usage();
+    } else if (std::strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+      opt.profile = argv[++i];
+    } else if (std::strcmp(argv[i], "-samples") == 0 && i + 1 < argc) {
+      opt.samples = std::atoi(argv[++i]);
+      if (opt.samples < 1)
+	usage();
+    } else if (std::strcmp(argv[i], "-seed") == 0 && i + 1 < argc) {
+      opt.seed = std::strtoul(argv[++i], nullptr, 0);
+    } else if (std::strcmp(argv[i], "-image") == 0 && i + 1 < argc) {
+      opt.image = argv[++i];
+      if (!threads::format_of(opt.image, opt.format))
+	usage();
+    } else if (std::strcmp(argv[i], "-band") == 0 && i + 1 < argc) {
+      opt.band = std::atoi(argv[++i]);
+      if (opt.band < 1)
+	usage();
+    } else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      opt.nthreads = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-schedule") == 0 && i + 1 < argc) {
+      if (!threads::parse_schedule(argv[++i], opt.sched))
+	usage();
+    } else if (std::strcmp(argv[i], "-chunk") == 0 && i + 1 < argc) {
+      opt.chunk = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-isa") == 0 && i + 1 < argc) {
+      if (!threads::parse_isa(argv[++i], opt.kernel))
+	usage();
+    } else if (std::strcmp(argv[i], "-interior") == 0) {
+      opt.interior = true;
+    } else {
+      usage();
+    }
+  }
+  if ((opt.image || opt.profile || opt.cache) && std::strcmp(opt.mode, "grid") != 0)
+    usage();
+  if (opt.profile && (opt.image || opt.cache))
+    usage();
+  return opt;
+}
+
+// Count the points of the grid in the set, iterating every one
+long count_grid(threads::thread_pool& pool, const threads::grid& g, const options& opt) {
+  // With a cost profile from an earlier run, each thread just gets a
+  // block of rows of equal cost. Otherwise, if asked to, measure the
+  // cost of each row for next time.
+  threads::cost_profile profile(g, opt.maxiter, opt.interior);
+  const bool profiled = opt.profile && profile.load(opt.profile);
+  std::vector<double> costs(opt.profile && !profiled ? g.n : 0);
+
+  // Outer loop over rows is shared out between the threads
+  // Each row is a run of points with the same real part, which the
+  // kernel iterates several at a time with z=z*z+c, and threshold test
+  // Each thread keeps its own count, on a cache line of its own, and
+  // we add them up at the end.
+  threads::reduction<long> counts(pool.size());
+  auto rows = [&](std::size_t begin, std::size_t end, unsigned t) {
+    std::vector<double> re(g.n), im(g.n);
+    std::vector<int> iters(g.n);
+    long inside = 0;
+    for (auto i = begin; i < end; ++i) {
+      for (int j = 0; j < g.n; ++j) {
+	re[j] = g.re(i);
+	im[j] = g.im(j);
+      }
+      threads::escape_counts(re.data(), im.data(), g.n, opt.maxiter, iters.data(),
+			     opt.kernel, opt.interior);
+      for (auto n: iters)
+	if (n == opt.maxiter)
+	  inside++;
+      if (!costs.empty())
+	costs[i] = profile.row_cost(g, i, iters.data());
+    }
+    counts[t] += inside;
+  };
+  if (profiled)
+    threads::parallel_blocks(pool, profile.partition(g.n, pool.size()), rows);
+  else
+    threads::parallel_for(pool, g.n, opt.sched, opt.chunk, rows);
+
+  if (profiled) {
+    std::printf("Used cost profile %s\n", profile.filename(opt.profile).c_str());
+  } else if (opt.profile) {
+    profile.record(costs);
+    if (profile.save(opt.profile))
+      std::printf("Saved cost profile %s\n", profile.filename(opt.profile).c_str());
+    else
+      std::fprintf(stderr, "Failed to save cost profile in %s\n", opt.profile);
+  }
+  return counts.result();
+}
+
+// Escape counts of tile (ti, tj) of the grid, from the cache if it's
+// there, or else computed and saved in it. Tiles are numbered as in
+// the image: ti across the real axis and tj down from the top row of
+// the grid. The counts are a row of the image at a time.
+std::vector<int> tile_counts(const threads::grid& g, const options& opt,
+			     threads::tile_cache& cache, int ti, int tj) {
+  const threads::tile_key key{g.re0 + 0.5 * g.scale_re, g.im0 + 0.5 * g.scale_im,
+      g.scale_re, g.scale_im, g.n, opt.tile, ti, tj, opt.maxiter, "double"};
+  const int i0 = ti * opt.tile, i1 = std::min(g.n, i0 + opt.tile);
+  const int r0 = tj * opt.tile, r1 = std::min(g.n, r0 + opt.tile);
+  const int width = i1 - i0;
+  std::vector<int> counts;
+  if (cache.load(key, std::size_t(r1 - r0) * width, counts))
+    return counts;
+
+  counts.resize(std::size_t(r1 - r0) * width);
+  std::vector<double> re(width), im(width);
+  for (int r = r0; r < r1; ++r) {
+    const long j = g.n - 1 - r;
+    for (int i = i0; i < i1; ++i) {
+      re[i - i0] = g.re(i);
+      im[i - i0] = g.im(j);
+    }
+    threads::escape_counts(re.data(), im.data(), width, opt.maxiter,
+			   counts.data() + std::size_t(r - r0) * width, opt.kernel, opt.interior);
+  }
+  cache.store(key, counts);
+  return counts;
+}
+
+// As count_grid, but a tile at a time through the cache
+long count_grid_cached(threads::thread_pool& pool, const threads::grid& g, const options& opt,
+		       threads::tile_cache& cache) {
+  const int ntiles = (g.n + opt.tile - 1) / opt.tile;
+  threads::reduction<long> counts(pool.size());
+  threads::parallel_for(pool, std::size_t(ntiles) * ntiles, threads::schedule::dynamic, 1,
+			[&](std::size_t begin, std::size_t end, unsigned t) {
+    long inside = 0;
+    for (auto k = begin; k < end; ++k)
+      for (auto n: tile_counts(g, opt, cache, k % ntiles, k / ntiles))
+	if (n == opt.maxiter)
+	  inside++;
+    counts[t] += inside;
+  });
+  return counts.result();
+}
+
+// As count_grid, but also write the escape counts to opt.image, with
+// the real axis across and the imaginary axis up. The image is done
+// in bands of rows of constant imaginary part, which the writer puts
+// on disk in order while the threads work on the next ones.
+long count_grid_image(threads::thread_pool& pool, const threads::grid& g, const options& opt,
+		      threads::tile_cache* cache) {
+  // With the cache, a band is a row of tiles
+  const int band = cache ? opt.tile : opt.band;
+  // Enough bands in flight to keep every thread busy while one waits
+  // for the disk
+  threads::image_writer out(opt.image, opt.format, g.n, g.n, band, 2 * pool.size());
+  threads::reduction<long> counts(pool.size());
+  // Bands are handed out one at a time whatever -schedule says. With
+  // blocks of bands (static, or guided's big first chunks) every
+  // thread but the first would wait in reserve() until the first had
+  // nearly finished its block, and the run would be serial.
+  threads::parallel_for(pool, out.bands(), threads::schedule::dynamic, 1,
+			[&](std::size_t begin, std::size_t end, unsigned t) {
+    std::vector<double> re(g.n), im(g.n);
+    std::vector<int> iters(g.n);
+    long inside = 0;
+    // Saturate rather than wrap for maxiter > 65535
+    auto pixel = [&](int n) -> std::uint16_t {
+      if (n == opt.maxiter)
+	inside++;
+      return n < 65535 ? n : 65535;
+    };
+    for (auto b = begin; b < end; ++b) {
+      out.reserve(b);
+      const int rows = out.rows(b);
+      std::vector<std::uint16_t> pixels(std::size_t(rows) * g.n);
+      if (cache) {
+	for (int ti = 0; ti * opt.tile < g.n; ++ti) {
+	  const auto tile = tile_counts(g, opt, *cache, ti, b);
+	  const int i0 = ti * opt.tile, width = std::min(g.n - i0, opt.tile);
+	  for (int r = 0; r < rows; ++r)
+	    for (int i = 0; i < width; ++i)
+	      pixels[std::size_t(r) * g.n + i0 + i] = pixel(tile[std::size_t(r) * width + i]);
+	}
+      } else {
+	for (int r = 0; r < rows; ++r) {
+	  // Top row first
+	  const long j = g.n - 1 - (long(b) * band + r);
+	  for (int i = 0; i < g.n; ++i) {
+	    re[i] = g.re(i);
+	    im[i] = g.im(j);
+	  }
+	  threads::escape_counts(re.data(), im.data(), g.n, opt.maxiter, iters.data(),
+				 opt.kernel, opt.interior);
+	  std::uint16_t* row = pixels.data() + std::size_t(r) * g.n;
+	  for (int i = 0; i < g.n; ++i)
+	    row[i] = pixel(iters[i]);
+	}
+      }
+      out.write(b, std::move(pixels));
+    }
+    counts[t] += inside;
+  });
+  if (!out.close()) {
+    std::fprintf(stderr, "Failed to write %s\n", opt.image);
+    std::exit(1);
+  }
+  return counts.result();
+}
+
+// Count the points in the set of the npoints x npoints grid over the
+// square of side width around centre, by perturbation
+long count_deepzoom(threads::thread_pool& pool, const options& opt) {
+  const int n = opt.npoints;
+  // Every pixel is within half a diagonal of the centre
+  const threads::perturbation ref(opt.centre_re, opt.centre_im, opt.maxiter,
+				  opt.width * std::sqrt(0.5));
+  threads::reduction<long> counts(pool.size()), rebases(pool.size());
+  threads::parallel_for(pool, n, opt.sched, opt.chunk,
+			[&](std::size_t begin, std::size_t end, unsigned t) {
+    long inside = 0, glitches = 0;
+    for (auto i = begin; i < end; ++i) {
+      const double dcr = opt.width * (double(i) - 0.5 * n) / n;
+      for (int j = 0; j < n; ++j) {
+	const double dci = opt.width * (double(j) - 0.5 * n) / n;
+	if (ref.escape_count(dcr, dci, glitches) == opt.maxiter)
+	  inside++;
+      }
+    }
+    counts[t] += inside;
+    rebases[t] += glitches;
+  });
+  const long num_inside = counts.result(), num_rebases = rebases.result();
+  std::printf("Reference orbit = %d iterations, %d skipped by series approximation\n",
+	      ref.orbit_length(), ref.skipped());
+  std::printf("Rebases = %ld\n", num_rebases);
+  // The area is usually too small to see in the usual output
+  std::printf("Points inside = %ld of %ld\n", num_inside, long(n) * n);
+  return num_inside;
+}
+
+// Area of the whole set from the count of grid points in the top half
+double area_of(const threads::grid& g, long num_inside) {
+  return 2.0 * g.area() * double(num_inside) / (double(g.n) * g.n);
+}
+
+// Refine the grid until the area stops changing by more than the
+// target, printing the estimate at each level. Returns the final
+// grid size, and the count and error estimate for it.
+int run_progressive(threads::thread_pool& pool, const threads::grid& g, const options& opt,
+		    long& num_inside, double& error) {
+  threads::progressive prog(g, opt.maxiter, opt.kernel, opt.interior);
+  double last = 0;
+  for (int n = opt.npoints; ; n *= 2) {
+    if (n == opt.npoints)
+      prog.first(pool, n);
+    else
+      prog.refine(pool);
+    num_inside = prog.inside();
+    const double area = area_of(prog.current(), num_inside);
+    // Until we have two levels to compare, use the usual estimate
+    error = n == opt.npoints ? area / n : std::abs(area - last);
+    last = area;
+    std::printf("N = %6d: area = %12.8f +/- %12.8f (%ld points iterated)\n",
+		n, area, error, prog.iterated());
+    if (error <= opt.target || 2 * n > opt.maxpoints)
+      return n;
   }
-  return true;
 }
 
-int main() {
-  const auto NPOINTS = 2000;
+int main(int argc, char* argv[]) {
+  const auto opt = parse_args(argc, argv);
+  auto NPOINTS = opt.npoints;
 
   const auto scale_real = 2.5;
   const auto scale_imag = 1.125;
   const auto eps = 1.0e-7;
   const auto shift = complex{-2.0 + eps, 0.0 + eps};
+  // The top half of the set; it's symmetric so we double the area
+  const threads::grid g{shift.real(), shift.imag(), scale_real, scale_imag, NPOINTS};
+
+  threads::thread_pool pool(opt.nthreads);
   using clock = std::chrono::high_resolution_clock;
   auto start = clock::now();
 
-  // Outer loops run over npoints, initialise z=c
-  // Inner loop has the iteration z=z*z+c, and threshold test
-  int num_inside = 0;
-  for (int i = 0; i < NPOINTS; ++i) {
-    for (int j = 0; j < NPOINTS; ++j) {
-      const auto c = shift + complex{(scale_real * i) / NPOINTS,
-                                     (scale_imag * j) / NPOINTS};
-      if (in_mandelbrot(c))
-	num_inside++;
-    }
+  long num_inside;
+  double error = -1;
+  double area_scale = 2.0 * scale_real * scale_imag;
+  if (std::strcmp(opt.mode, "deepzoom") == 0) {
+    // Just the part of the set in the view
+    num_inside = count_deepzoom(pool, opt);
+    area_scale = opt.width * opt.width;
+  } else if (std::strcmp(opt.mode, "montecarlo") == 0) {
+    const auto est = threads::stratified_sample(pool, g, opt.samples, opt.seed, opt.maxiter,
+						opt.kernel, opt.interior, opt.sched, opt.chunk);
+    num_inside = est.inside;
+    area_scale /= opt.samples;
+    error = area_scale * opt.samples * est.error;
+    std::printf("Samples = %ld, %ld inside\n", est.samples, est.inside);
+  } else if (std::strcmp(opt.mode, "progressive") == 0) {
+    NPOINTS = run_progressive(pool, g, opt, num_inside, error);
+  } else if (std::strcmp(opt.mode, "subdivide") == 0) {
+    threads::subdivider sub(g, opt.maxiter, opt.kernel, opt.interior);
+    num_inside = sub.count(pool);
+    std::printf("Points iterated = %ld of %ld\n", sub.iterated(), long(NPOINTS) * NPOINTS);
+  } else if (opt.image || opt.cache) {
+    std::unique_ptr<threads::tile_cache> cache;
+    if (opt.cache)
+      cache.reset(new threads::tile_cache(opt.cache, std::uint64_t(opt.cache_mb) << 20));
+    if (opt.image)
+      num_inside = count_grid_image(pool, g, opt, cache.get());
+    else
+      num_inside = count_grid_cached(pool, g, opt, *cache);
+    if (cache)
+      std::printf("Tiles = %ld from cache, %ld computed\n", cache->hits(), cache->misses());
+  } else {
+    num_inside = count_grid(pool, g, opt);
   }
   auto finish = clock::now();
 
   // Calculate area and error and output the results
-  auto area = 2.0 * scale_real * scale_imag * double(num_inside) / double(NPOINTS * NPOINTS);
-  auto error = area / double(NPOINTS);
+  auto area = area_scale * double(num_inside) / (double(NPOINTS) * NPOINTS);
+  if (error < 0)
+    error = area / double(NPOINTS);
 
   std::printf("Area of Mandlebrot set = %12.8f +/- %12.8f\n", area, error);
   auto dt = std::chrono::duration<double>(finish-start);
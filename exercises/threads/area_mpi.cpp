@@ -0,0 +1,220 @@
+// Mandelbrot area over several processes with MPI.
+//
+// Rank 0 hands out chunks of rows of the grid, and the other ranks
+// work through them with a thread pool each, asking for another chunk
+// whenever they finish one. Rows near the set take much longer than
+// the rest, so this balances the load without knowing the costs in
+// advance. At the end the counts are added up with MPI_Reduce.
+//
+// Run with e.g.
+//
+//   mpirun -np 4 ./area_mpi -npoints 4000
+//
+// With one rank, rank 0 does all the work itself.
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include <mpi.h>
+
+#include "mandelbrot.hpp"
+#include "reduction.hpp"
+#include "thread_pool.hpp"
+
+// Settings from the command line
+struct options {
+  int npoints = 2000;
+  int maxiter = 2000;
+  int chunk = 8;
+  unsigned nthreads = 0;
+  threads::isa kernel = threads::best_isa();
+  bool interior = false;
+};
+
+void usage(int rank) {
+  if (rank == 0) {
+    std::printf("  Mandelbrot area (MPI) options:\n");
+    std::printf("  -npoints <int>:   grid points along each side (default: 2000)\n");
+    std::printf("  -maxiter <int>:   iterations before a point counts as inside\n");
+    std::printf("                    (default: 2000)\n");
+    std::printf("  -chunk <int>:     rows handed out at a time (default: 8)\n");
+    std::printf("  -threads <int>:   threads per process (default: the cores shared\n");
+    std::printf("                    out between the working processes on each\n");
+    std::printf("                    node)\n");
+    std::printf("  -isa <name>:      kernel to use: scalar, avx2 or avx512\n");
+    std::printf("                    (default: the best this CPU supports)\n");
+    std::printf("  -interior:        skip points proven to be inside\n");
+  }
+  MPI_Finalize();
+  std::exit(1);
+}
+
+options parse_args(int argc, char* argv[], int rank) {
+  options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-npoints") == 0 && i + 1 < argc) {
+      opt.npoints = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-maxiter") == 0 && i + 1 < argc) {
+      opt.maxiter = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-chunk") == 0 && i + 1 < argc) {
+      opt.chunk = std::atoi(argv[++i]);
+      if (opt.chunk < 1)
+	usage(rank);
+    } else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      opt.nthreads = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-isa") == 0 && i + 1 < argc) {
+      if (!threads::parse_isa(argv[++i], opt.kernel))
+	usage(rank);
+    } else if (std::strcmp(argv[i], "-interior") == 0) {
+      opt.interior = true;
+    } else {
+      usage(rank);
+    }
+  }
+  return opt;
+}
+
+// Count the points inside in rows begin to end - 1 of the grid
+long count_rows(threads::thread_pool& pool, const threads::grid& g, const options& opt,
+		int begin, int end) {
+  threads::reduction<long> counts(pool.size());
+  threads::parallel_for(pool, end - begin, threads::schedule::dynamic, 1,
+			[&](std::size_t b, std::size_t e, unsigned t) {
+    std::vector<double> re(g.n), im(g.n);
+    std::vector<int> iters(g.n);
+    for (auto i = begin + b; i < begin + e; ++i) {
+      for (int j = 0; j < g.n; ++j) {
+	re[j] = g.re(i);
+	im[j] = g.im(j);
+      }
+      threads::escape_counts(re.data(), im.data(), g.n, opt.maxiter, iters.data(),
+			     opt.kernel, opt.interior);
+      for (auto n: iters)
+	if (n == opt.maxiter)
+	  counts[t]++;
+    }
+  });
+  return counts.result();
+}
+
+// Message tags
+const int tag_request = 1;
+const int tag_work = 2;
+
+// Rank 0: hand out the first row of the next chunk to whoever asks,
+// then -1 to each worker when there are none left
+void master(int nranks, const options& opt) {
+  int next = 0, stopped = 0;
+  while (stopped < nranks - 1) {
+    int dummy;
+    MPI_Status status;
+    MPI_Recv(&dummy, 1, MPI_INT, MPI_ANY_SOURCE, tag_request, MPI_COMM_WORLD, &status);
+    int row = -1;
+    if (next < opt.npoints) {
+      row = next;
+      next += opt.chunk;
+    } else {
+      stopped++;
+    }
+    MPI_Send(&row, 1, MPI_INT, status.MPI_SOURCE, tag_work, MPI_COMM_WORLD);
+  }
+}
+
+// The other ranks: ask for chunks until told to stop, and return the
+// count of points inside and the number of chunks done
+long worker(threads::thread_pool& pool, const threads::grid& g, const options& opt,
+	    long& chunks) {
+  long inside = 0;
+  chunks = 0;
+  for (;;) {
+    int row, request = 0;
+    MPI_Send(&request, 1, MPI_INT, 0, tag_request, MPI_COMM_WORLD);
+    MPI_Recv(&row, 1, MPI_INT, 0, tag_work, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+    if (row < 0)
+      return inside;
+    const int end = row + opt.chunk < g.n ? row + opt.chunk : g.n;
+    inside += count_rows(pool, g, opt, row, end);
+    chunks++;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  // Only the main thread of each process talks to MPI
+  int provided;
+  MPI_Init_thread(&argc, &argv, MPI_THREAD_FUNNELED, &provided);
+  int rank, nranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+  // The pool's threads run alongside MPI calls on the main thread,
+  // which isn't allowed below FUNNELED
+  if (provided < MPI_THREAD_FUNNELED) {
+    if (rank == 0)
+      std::fprintf(stderr, "MPI library doesn't support MPI_THREAD_FUNNELED\n");
+    MPI_Abort(MPI_COMM_WORLD, 1);
+  }
+
+  auto opt = parse_args(argc, argv, rank);
+  if (opt.nthreads == 0) {
+    // Share the cores between the ranks on this node that do the
+    // work. With more than one rank, rank 0 only hands out chunks and
+    // has no pool, so doesn't get a share.
+    MPI_Comm node;
+    MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &node);
+    int local;
+    MPI_Comm_size(node, &local);
+    // Ranks are in world order, so the first on a node is rank 0 if
+    // it's there at all
+    int first = rank;
+    MPI_Bcast(&first, 1, MPI_INT, 0, node);
+    MPI_Comm_free(&node);
+    const int workers = (nranks > 1 && first == 0) ? local - 1 : local;
+    opt.nthreads = std::max(1U, std::thread::hardware_concurrency() / std::max(1, workers));
+  }
+  const auto NPOINTS = opt.npoints;
+
+  // The same grid as area.cpp
+  const auto scale_real = 2.5;
+  const auto scale_imag = 1.125;
+  const auto eps = 1.0e-7;
+  const threads::grid g{-2.0 + eps, 0.0 + eps, scale_real, scale_imag, NPOINTS};
+
+  MPI_Barrier(MPI_COMM_WORLD);
+  const double start = MPI_Wtime();
+
+  long local = 0, chunks = 0;
+  if (nranks == 1) {
+    threads::thread_pool pool(opt.nthreads);
+    local = count_rows(pool, g, opt, 0, NPOINTS);
+  } else if (rank == 0) {
+    master(nranks, opt);
+  } else {
+    threads::thread_pool pool(opt.nthreads);
+    local = worker(pool, g, opt, chunks);
+  }
+
+  long num_inside = 0;
+  MPI_Reduce(&local, &num_inside, 1, MPI_LONG, MPI_SUM, 0, MPI_COMM_WORLD);
+  std::vector<long> done(nranks);
+  MPI_Gather(&chunks, 1, MPI_LONG, done.data(), 1, MPI_LONG, 0, MPI_COMM_WORLD);
+  const double finish = MPI_Wtime();
+
+  if (rank == 0) {
+    // Calculate area and error and output the results
+    auto area = 2.0 * scale_real * scale_imag * double(num_inside) / (double(NPOINTS) * NPOINTS);
+    auto error = area / double(NPOINTS);
+
+    if (nranks > 1) {
+      std::printf("Chunks per rank =");
+      for (int r = 1; r < nranks; ++r)
+	std::printf(" %ld", done[r]);
+      std::printf("\n");
+    }
+    std::printf("Area of Mandlebrot set = %12.8f +/- %12.8f\n", area, error);
+    std::printf("Time = %12.8f seconds\n", finish - start);
+  }
+  MPI_Finalize();
+}
@@ -0,0 +1,352 @@
+// Compare ways of running the Mandelbrot area loop in parallel.
+//
+// Every back-end runs the same kernel, escape_counts on one row of the
+// grid, over the rows of the grid, and adds up the points inside. For
+// each thread count asked for, each back-end is timed and a CSV line
+//
+//   CSV: backend, threads, npoints, maxiter, seconds, speedup
+//
+// is printed, with speedup relative to the serial loop. backends.sh
+// collects these for plot.ipynb in ../kokkos.
+//
+// The OpenMP back-end needs building with OpenMP, and the Kokkos ones
+// with Kokkos and THREADS_HAVE_KOKKOS defined. Kokkos sets its number
+// of threads once, at initialisation (--kokkos-threads=N), so those
+// back-ends only run when the thread count matches it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#ifdef THREADS_HAVE_KOKKOS
+#include <Kokkos_Core.hpp>
+#endif
+
+#include "mandelbrot.hpp"
+
+enum class backend { serial, thread, async, openmp, kokkos_range, kokkos_team };
+
+const backend all_backends[] = {
+  backend::serial, backend::thread, backend::async, backend::openmp,
+  backend::kokkos_range, backend::kokkos_team
+};
+
+const char* name(backend b) {
+  switch (b) {
+  case backend::serial:
+    return "serial";
+  case backend::thread:
+    return "thread";
+  case backend::async:
+    return "async";
+  case backend::openmp:
+    return "openmp";
+  case backend::kokkos_range:
+    return "kokkos-range";
+  default:
+    return "kokkos-team";
+  }
+}
+
+// Was this back-end built in?
+bool available(backend b) {
+  switch (b) {
+  case backend::openmp:
+#ifdef _OPENMP
+    return true;
+#else
+    return false;
+#endif
+  case backend::kokkos_range:
+  case backend::kokkos_team:
+#ifdef THREADS_HAVE_KOKKOS
+    return true;
+#else
+    return false;
+#endif
+  default:
+    return true;
+  }
+}
+
+// Settings from the command line
+struct options {
+  int npoints = 2000;
+  int maxiter = 2000;
+  std::vector<unsigned> nthreads;
+  std::vector<backend> backends;
+  int repeat = 3;
+  threads::isa kernel = threads::best_isa();
+};
+
+void usage() {
+  std::printf("  Mandelbrot back-end comparison options:\n");
+  std::printf("  -npoints <int>:   grid points along each side (default: 2000)\n");
+  std::printf("  -maxiter <int>:   iterations before a point counts as inside\n");
+  std::printf("                    (default: 2000)\n");
+  std::printf("  -threads <list>:  comma separated thread counts (default: 1, 2, 4,\n");
+  std::printf("                    ... up to the number of cores)\n");
+  std::printf("  -backends <list>: comma separated, from serial, thread, async,\n");
+  std::printf("                    openmp, kokkos-range and kokkos-team\n");
+  std::printf("                    (default: all those built in)\n");
+  std::printf("  -repeat <int>:    take the best of this many runs (default: 3)\n");
+  std::printf("  -isa <name>:      kernel to use: scalar, avx2 or avx512\n");
+  std::printf("                    (default: the best this CPU supports)\n");
+  std::printf("  -list:            print the back-ends built in and stop\n");
+  std::exit(1);
+}
+
+// Split a comma separated list
+std::vector<std::string> split(const char* str) {
+  std::vector<std::string> ans(1);
+  for (; *str; ++str) {
+    if (*str == ',')
+      ans.emplace_back();
+    else
+      ans.back() += *str;
+  }
+  return ans;
+}
+
+options parse_args(int argc, char* argv[]) {
+  options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-npoints") == 0 && i + 1 < argc) {
+      opt.npoints = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-maxiter") == 0 && i + 1 < argc) {
+      opt.maxiter = std::atoi(argv[++i]);
+    } else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      for (auto& t: split(argv[++i])) {
+	const int n = std::atoi(t.c_str());
+	if (n < 1)
+	  usage();
+	opt.nthreads.push_back(n);
+      }
+    } else if (std::strcmp(argv[i], "-backends") == 0 && i + 1 < argc) {
+      for (auto& s: split(argv[++i])) {
+	bool found = false;
+	for (auto b: all_backends)
+	  if (s == name(b) && available(b)) {
+	    opt.backends.push_back(b);
+	    found = true;
+	  }
+	if (!found)
+	  usage();
+      }
+    } else if (std::strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+      opt.repeat = std::atoi(argv[++i]);
+      if (opt.repeat < 1)
+	usage();
+    } else if (std::strcmp(argv[i], "-isa") == 0 && i + 1 < argc) {
+      if (!threads::parse_isa(argv[++i], opt.kernel))
+	usage();
+    } else if (std::strcmp(argv[i], "-list") == 0) {
+      for (auto b: all_backends)
+	if (available(b))
+	  std::printf("%s\n", name(b));
+      std::exit(0);
+    } else if (std::strncmp(argv[i], "--kokkos-", 9) == 0) {
+      // Kokkos::initialize has had these already, if built with it
+    } else {
+      usage();
+    }
+  }
+  if (opt.nthreads.empty()) {
+    const unsigned cores = std::max(1U, std::thread::hardware_concurrency());
+    for (unsigned t = 1; t < cores; t *= 2)
+      opt.nthreads.push_back(t);
+    opt.nthreads.push_back(cores);
+  }
+  if (opt.backends.empty())
+    for (auto b: all_backends)
+      if (available(b))
+	opt.backends.push_back(b);
+  return opt;
+}
+
+// The kernel: number of points of row i of the grid in the set
+long row_inside(const threads::grid& g, long i, const options& opt) {
+  std::vector<double> re(g.n, g.re(i)), im(g.n);
+  std::vector<int> iters(g.n);
+  for (int j = 0; j < g.n; ++j)
+    im[j] = g.im(j);
+  threads::escape_counts(re.data(), im.data(), g.n, opt.maxiter, iters.data(), opt.kernel);
+  long inside = 0;
+  for (auto n: iters)
+    if (n == opt.maxiter)
+      inside++;
+  return inside;
+}
+
+long count_serial(const threads::grid& g, const options& opt) {
+  long inside = 0;
+  for (long i = 0; i < g.n; ++i)
+    inside += row_inside(g, i, opt);
+  return inside;
+}
+
+// Threads take the next row from a shared counter, as rows near the
+// set take much longer than the rest, and add their count to the
+// total at the end.
+long count_thread(const threads::grid& g, const options& opt, unsigned nthreads) {
+  std::atomic<long> next(0), total(0);
+  std::vector<std::thread> team;
+  for (unsigned t = 0; t < nthreads; ++t)
+    team.emplace_back([&]() {
+	long inside = 0;
+	for (long i; (i = next++) < g.n;)
+	  inside += row_inside(g, i, opt);
+	total += inside;
+      });
+  for (auto& t: team)
+    t.join();
+  return total;
+}
+
+// The same, but each task hands back its count through a future
+long count_async(const threads::grid& g, const options& opt, unsigned nthreads) {
+  std::atomic<long> next(0);
+  std::vector<std::future<long>> parts;
+  for (unsigned t = 0; t < nthreads; ++t)
+    parts.push_back(std::async(std::launch::async, [&]() {
+	  long inside = 0;
+	  for (long i; (i = next++) < g.n;)
+	    inside += row_inside(g, i, opt);
+	  return inside;
+	}));
+  long total = 0;
+  for (auto& p: parts)
+    total += p.get();
+  return total;
+}
+
+#ifdef _OPENMP
+long count_openmp(const threads::grid& g, const options& opt, unsigned nthreads) {
+  long inside = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:inside) num_threads(nthreads)
+  for (long i = 0; i < g.n; ++i)
+    inside += row_inside(g, i, opt);
+  return inside;
+}
+#endif
+
+#ifdef THREADS_HAVE_KOKKOS
+using host_space = Kokkos::DefaultHostExecutionSpace;
+
+// A row per iteration, handed out dynamically like the others
+long count_kokkos_range(const threads::grid& g, const options& opt) {
+  long inside = 0;
+  Kokkos::parallel_reduce(Kokkos::RangePolicy<host_space, Kokkos::Schedule<Kokkos::Dynamic>>(0, g.n),
+			  [&](long i, long& in) {
+			    in += row_inside(g, i, opt);
+			  }, inside);
+  return inside;
+}
+
+// A row per team, with its points shared out over the team's threads.
+// This uses the scalar kernel, as a thread's points aren't contiguous.
+long count_kokkos_team(const threads::grid& g, const options& opt) {
+  using policy = Kokkos::TeamPolicy<host_space, Kokkos::Schedule<Kokkos::Dynamic>>;
+  long inside = 0;
+  Kokkos::parallel_reduce(policy(g.n, Kokkos::AUTO),
+			  [&](const policy::member_type& team, long& in) {
+			    const long i = team.league_rank();
+			    long row = 0;
+			    Kokkos::parallel_reduce(Kokkos::TeamThreadRange(team, g.n),
+						    [&](int j, long& r) {
+						      r += threads::escape_count(g.re(i), g.im(j), opt.maxiter)
+							== opt.maxiter;
+						    }, row);
+			    Kokkos::single(Kokkos::PerTeam(team), [&]() { in += row; });
+			  }, inside);
+  return inside;
+}
+#endif
+
+long count(backend b, const threads::grid& g, const options& opt, unsigned nthreads) {
+  switch (b) {
+  case backend::thread:
+    return count_thread(g, opt, nthreads);
+  case backend::async:
+    return count_async(g, opt, nthreads);
+#ifdef _OPENMP
+  case backend::openmp:
+    return count_openmp(g, opt, nthreads);
+#endif
+#ifdef THREADS_HAVE_KOKKOS
+  case backend::kokkos_range:
+    return count_kokkos_range(g, opt);
+  case backend::kokkos_team:
+    return count_kokkos_team(g, opt);
+#endif
+  default:
+    return count_serial(g, opt);
+  }
+}
+
+// Can b run on exactly nthreads threads?
+bool runs_on(backend b, unsigned nthreads) {
+#ifdef THREADS_HAVE_KOKKOS
+  if (b == backend::kokkos_range || b == backend::kokkos_team)
+    return unsigned(host_space::concurrency()) == nthreads;
+#endif
+  return b != backend::serial || nthreads == 1;
+}
+
+int main(int argc, char* argv[]) {
+#ifdef THREADS_HAVE_KOKKOS
+  Kokkos::initialize(argc, argv);
+#endif
+  {
+    const auto opt = parse_args(argc, argv);
+    // The same grid as area.cpp
+    const double eps = 1.0e-7;
+    const threads::grid g{-2.0 + eps, 0.0 + eps, 2.5, 1.125, opt.npoints};
+
+    using clock = std::chrono::high_resolution_clock;
+    auto best_time = [&](backend b, unsigned nthreads, long& inside) {
+      double best = 0;
+      for (int r = 0; r < opt.repeat; ++r) {
+	const auto start = clock::now();
+	inside = count(b, g, opt, nthreads);
+	const double dt = std::chrono::duration<double>(clock::now() - start).count();
+	if (r == 0 || dt < best)
+	  best = dt;
+      }
+      return best;
+    };
+
+    // Everything is compared against the serial loop
+    long expected = 0;
+    const double serial = best_time(backend::serial, 1, expected);
+
+    for (auto t: opt.nthreads) {
+      for (auto b: opt.backends) {
+	if (!runs_on(b, t))
+	  continue;
+	long inside = expected;
+	const double dt = b == backend::serial ? serial : best_time(b, t, inside);
+	if (b != backend::serial && inside != expected) {
+	  std::fprintf(stderr, "%s on %u threads counted %ld points inside, not %ld\n",
+		       name(b), t, inside, expected);
+	  std::exit(1);
+	}
+	std::printf("CSV: %s, %u, %d, %d, %g, %g\n", name(b), t, opt.npoints, opt.maxiter,
+		    dt, serial / dt);
+      }
+    }
+  }
+#ifdef THREADS_HAVE_KOKKOS
+  Kokkos::finalize();
+#endif
+}
@@ -0,0 +1,35 @@
+#!/bin/bash
+#
+# Time every back-end built into ./backends (see backends.cpp) over a
+# range of thread counts and write the results as CSV for plot.ipynb
+# in ../kokkos.
+#
+# Usage: ./backends.sh [output file] [options for backends]
+#
+# Kokkos fixes its thread count when it starts, so for a Kokkos build
+# its back-ends are run once per thread count.
+
+out=${1:-backends.csv}
+shift
+
+cores=$(nproc)
+threads=1
+for ((t = 2; t < cores; t *= 2)); do
+    threads="$threads,$t"
+done
+if [ $cores -gt 1 ]; then
+    threads="$threads,$cores"
+fi
+
+echo "backend, threads, npoints, maxiter, seconds, speedup" > $out
+
+nonkokkos=$(./backends -list | grep -v kokkos | paste -sd,)
+./backends -threads $threads -backends $nonkokkos "$@" | sed -n 's/^CSV: //p' >> $out
+
+kokkos=$(./backends -list | grep kokkos | paste -sd,)
+if [ -n "$kokkos" ]; then
+    for t in ${threads//,/ }; do
+	./backends -threads $t -backends $kokkos --kokkos-threads=$t "$@" |
+	    sed -n 's/^CSV: //p' | grep -v '^serial' >> $out
+    done
+fi
@@ -0,0 +1,202 @@
+// How much does it cost for threads to update a shared counter?
+//
+// Each thread does a fixed share of a loop in which a cheap
+// pseudo-random test stands in for the Mandelbrot kernel, and counts
+// the iterations that pass, like the points inside the set in
+// area.cpp. The count is kept in one of four ways:
+//
+//   mutex:      a shared long, locked and unlocked by hand
+//   lock_guard: the same, with std::lock_guard
+//   atomic:     a shared std::atomic<long>
+//   padded:     a threads::reduction, with the per-thread counts on
+//               separate cache lines, combined at the end
+//
+// and for each thread count a CSV line
+//
+//   CSV: strategy, threads, iterations, seconds, ns_per_iteration
+//
+// is printed. The first three serialise the threads on the counter's
+// cache line, so get slower as threads are added; the last doesn't.
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "reduction.hpp"
+
+// Settings from the command line
+struct options {
+  long iterations = 1L << 26;
+  std::vector<unsigned> nthreads = {1, 2, 4, 8, 16, 32, 64, 128};
+  int repeat = 3;
+};
+
+void usage() {
+  std::printf("  Counter contention benchmark options:\n");
+  std::printf("  -iterations <int>: loop trips, shared between the threads\n");
+  std::printf("                     (default: 2^26)\n");
+  std::printf("  -threads <int>:    largest thread count; 1, 2, 4, ... up to it are\n");
+  std::printf("                     run (default: 128)\n");
+  std::printf("  -repeat <int>:     take the best of this many runs (default: 3)\n");
+  std::exit(1);
+}
+
+options parse_args(int argc, char* argv[]) {
+  options opt;
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "-iterations") == 0 && i + 1 < argc) {
+      opt.iterations = std::atol(argv[++i]);
+    } else if (std::strcmp(argv[i], "-threads") == 0 && i + 1 < argc) {
+      const unsigned max = std::atoi(argv[++i]);
+      if (max < 1)
+	usage();
+      opt.nthreads.clear();
+      for (unsigned t = 1; t < max; t *= 2)
+	opt.nthreads.push_back(t);
+      opt.nthreads.push_back(max);
+    } else if (std::strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) {
+      opt.repeat = std::atoi(argv[++i]);
+      if (opt.repeat < 1)
+	usage();
+    } else {
+      usage();
+    }
+  }
+  return opt;
+}
+
+// The stand-in for real work: a xorshift generator, counting the
+// numbers with the bottom bit set
+inline std::uint64_t next(std::uint64_t x) {
+  x ^= x << 13;
+  x ^= x >> 7;
+  x ^= x << 17;
+  return x;
+}
+
+// Each thread has its own seed, so its share of the count differs
+inline std::uint64_t seed(unsigned t) {
+  return 0x9e3779b97f4a7c15ULL * (t + 1);
+}
+
+// Run body(t, trips) on nthreads threads, which between them make
+// iterations trips, and return the time taken
+template<class Body>
+double timed(unsigned nthreads, long iterations, Body body) {
+  using clock = std::chrono::high_resolution_clock;
+  const auto start = clock::now();
+  std::vector<std::thread> team;
+  for (unsigned t = 0; t < nthreads; ++t) {
+    const long trips = iterations / nthreads + (t < iterations % nthreads ? 1 : 0);
+    team.emplace_back(body, t, trips);
+  }
+  for (auto& th: team)
+    th.join();
+  return std::chrono::duration<double>(clock::now() - start).count();
+}
+
+// The answer every strategy should get
+long expected(unsigned nthreads, long iterations) {
+  long count = 0;
+  for (unsigned t = 0; t < nthreads; ++t) {
+    const long trips = iterations / nthreads + (t < iterations % nthreads ? 1 : 0);
+    std::uint64_t x = seed(t);
+    for (long i = 0; i < trips; ++i) {
+      x = next(x);
+      if (x & 1)
+	count++;
+    }
+  }
+  return count;
+}
+
+// Time one strategy on nthreads threads, returning the count in total
+double run(const char* strategy, unsigned nthreads, long iterations, long& total) {
+  if (std::strcmp(strategy, "mutex") == 0) {
+    long count = 0;
+    std::mutex m;
+    const double dt = timed(nthreads, iterations, [&](unsigned t, long trips) {
+	std::uint64_t x = seed(t);
+	for (long i = 0; i < trips; ++i) {
+	  x = next(x);
+	  if (x & 1) {
+	    m.lock();
+	    count++;
+	    m.unlock();
+	  }
+	}
+      });
+    total = count;
+    return dt;
+  } else if (std::strcmp(strategy, "lock_guard") == 0) {
+    long count = 0;
+    std::mutex m;
+    const double dt = timed(nthreads, iterations, [&](unsigned t, long trips) {
+	std::uint64_t x = seed(t);
+	for (long i = 0; i < trips; ++i) {
+	  x = next(x);
+	  if (x & 1) {
+	    std::lock_guard<std::mutex> lock(m);
+	    count++;
+	  }
+	}
+      });
+    total = count;
+    return dt;
+  } else if (std::strcmp(strategy, "atomic") == 0) {
+    std::atomic<long> count(0);
+    const double dt = timed(nthreads, iterations, [&](unsigned t, long trips) {
+	std::uint64_t x = seed(t);
+	for (long i = 0; i < trips; ++i) {
+	  x = next(x);
+	  if (x & 1)
+	    count++;
+	}
+      });
+    total = count;
+    return dt;
+  } else {
+    threads::reduction<long> count(nthreads);
+    const double dt = timed(nthreads, iterations, [&](unsigned t, long trips) {
+	std::uint64_t x = seed(t);
+	long& mine = count[t];
+	for (long i = 0; i < trips; ++i) {
+	  x = next(x);
+	  if (x & 1)
+	    mine++;
+	}
+	const long all = count.combine(t);
+	if (t == 0)
+	  total = all;
+      });
+    return dt;
+  }
+}
+
+int main(int argc, char* argv[]) {
+  const auto opt = parse_args(argc, argv);
+  for (auto t: opt.nthreads) {
+    const long answer = expected(t, opt.iterations);
+    for (auto strategy: {"mutex", "lock_guard", "atomic", "padded"}) {
+      double best = 0;
+      for (int r = 0; r < opt.repeat; ++r) {
+	long total = -1;
+	const double dt = run(strategy, t, opt.iterations, total);
+	if (total != answer) {
+	  std::fprintf(stderr, "%s on %u threads counted %ld, not %ld\n", strategy, t, total, answer);
+	  return 1;
+	}
+	if (r == 0 || dt < best)
+	  best = dt;
+      }
+      std::printf("CSV: %s, %u, %ld, %g, %g\n", strategy, t, opt.iterations, best,
+		  1e9 * best / opt.iterations);
+    }
+  }
+}
@@ -0,0 +1,239 @@
+#ifndef THREADS_IMAGE_HPP
+#define THREADS_IMAGE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef THREADS_HAVE_PNG
+#include <csetjmp>
+#include <png.h>
+#endif
+
+namespace threads {
+
+  // 16 bit greyscale image files, as binary PGM or (if built with
+  // THREADS_HAVE_PNG) PNG
+  enum class image_format { pgm, png };
+
+  // Work out the format from the file name's extension
+  inline bool format_of(const char* filename, image_format& f) {
+    const char* dot = std::strrchr(filename, '.');
+    if (dot && std::strcmp(dot, ".pgm") == 0) {
+      f = image_format::pgm;
+      return true;
+    }
+#ifdef THREADS_HAVE_PNG
+    if (dot && std::strcmp(dot, ".png") == 0) {
+      f = image_format::png;
+      return true;
+    }
+#endif
+    return false;
+  }
+
+  // Write an image to disk as it's computed, a band of rows at a
+  // time, without ever holding the whole thing in memory.
+  //
+  // Both formats are written top row first, so a writer thread takes
+  // the bands in order while the workers compute them in any order.
+  // At most capacity bands can be in flight: a worker has to
+  // reserve() band b before computing it, which blocks while b is
+  // capacity or more bands ahead of the one being written. So memory
+  // use is bounded and workers that get too far ahead wait for the
+  // disk, rather than the disk waiting for the whole image.
+  //
+  // NB:
+  //
+  //  - the band that's next to be written can always be reserved, so
+  //    as long as the workers take bands in increasing order (as
+  //    parallel_for does) this can't deadlock. But it can serialise:
+  //    if each worker has a block of more than capacity bands, all but
+  //    the first wait until that one is nearly done. So hand bands out
+  //    a few at a time (dynamic scheduling)
+  //
+  //  - errors are reported by ok() and close() rather than
+  //    exceptions, as they happen on the writer thread
+  class image_writer {
+  public:
+    image_writer(const char* filename, image_format format, int width, int height,
+		 int band_rows, int capacity)
+      : _format(format), _width(width), _height(height), _band_rows(band_rows),
+	_slots(capacity), _full(capacity, false), _next(0), _ok(true), _closed(false),
+	_file(std::fopen(filename, "wb")) {
+#ifdef THREADS_HAVE_PNG
+      _png = nullptr;
+      _info = nullptr;
+#endif
+      if (!_file) {
+	_ok = false;
+	return;
+      }
+      _ok = header();
+      _thread = std::thread([this]() { drain(); });
+    }
+
+    ~image_writer() {
+      close();
+    }
+
+    image_writer(const image_writer&) = delete;
+    image_writer& operator=(const image_writer&) = delete;
+
+    // Did everything work so far?
+    bool ok() const {
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _ok;
+    }
+
+    int bands() const {
+      return (_height + _band_rows - 1) / _band_rows;
+    }
+    // Rows in band b
+    int rows(int b) const {
+      const int r = _height - b * _band_rows;
+      return r < _band_rows ? r : _band_rows;
+    }
+
+    // Wait until band b can be computed
+    void reserve(int b) {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _space.wait(lock, [&]() { return b < _next + int(_slots.size()) || !_ok; });
+    }
+
+    // Hand over the rows(b) * width pixels of band b, top row first.
+    // It must have been reserved.
+    void write(int b, std::vector<std::uint16_t>&& pixels) {
+      std::lock_guard<std::mutex> lock(_mutex);
+      const int slot = b % int(_slots.size());
+      _slots[slot] = std::move(pixels);
+      _full[slot] = true;
+      _ready.notify_one();
+    }
+
+    // Wait for the writer to finish and close the file. Returns
+    // whether it all worked. Bands that never arrived leave the file
+    // incomplete.
+    bool close() {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (_closed)
+	  return _ok;
+	_closed = true;
+	_ready.notify_one();
+      }
+      if (_thread.joinable())
+	_thread.join();
+      if (_file) {
+	if (_ok && _next != bands())
+	  _ok = false;
+	finish();
+	if (std::fclose(_file) != 0)
+	  _ok = false;
+	_file = nullptr;
+      }
+      return _ok;
+    }
+
+  private:
+    // The writer thread: write out bands in order as they arrive
+    void drain() {
+      std::vector<std::uint8_t> row(2 * std::size_t(_width));
+      for (int b = 0; b < bands(); ++b) {
+	std::vector<std::uint16_t> pixels;
+	{
+	  std::unique_lock<std::mutex> lock(_mutex);
+	  const int slot = b % int(_slots.size());
+	  _ready.wait(lock, [&]() { return _full[slot] || _closed; });
+	  if (!_full[slot] || !_ok)
+	    return;
+	  pixels.swap(_slots[slot]);
+	  _full[slot] = false;
+	}
+	// Both formats store 16 bit samples big endian
+	bool good = true;
+	for (int r = 0; r < rows(b) && good; ++r) {
+	  const std::uint16_t* p = pixels.data() + std::size_t(r) * _width;
+	  for (int x = 0; x < _width; ++x) {
+	    row[2 * x] = p[x] >> 8;
+	    row[2 * x + 1] = p[x] & 0xff;
+	  }
+	  good = write_row(row.data());
+	}
+	std::lock_guard<std::mutex> lock(_mutex);
+	_ok = _ok && good;
+	++_next;
+	_space.notify_all();
+      }
+    }
+
+    bool header() {
+      if (_format == image_format::pgm)
+	return std::fprintf(_file, "P5\n%d %d\n65535\n", _width, _height) > 0;
+#ifdef THREADS_HAVE_PNG
+      _png = png_create_write_struct(PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr);
+      if (_png)
+	_info = png_create_info_struct(_png);
+      if (!_info)
+	return false;
+      // libpng reports errors by longjmp, so nothing with a destructor
+      // can be live here
+      if (setjmp(png_jmpbuf(_png)))
+	return false;
+      png_init_io(_png, _file);
+      png_set_IHDR(_png, _info, _width, _height, 16, PNG_COLOR_TYPE_GRAY, PNG_INTERLACE_NONE,
+		   PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+      png_write_info(_png, _info);
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    bool write_row(std::uint8_t* row) {
+      if (_format == image_format::pgm)
+	return std::fwrite(row, 2, _width, _file) == std::size_t(_width);
+#ifdef THREADS_HAVE_PNG
+      if (setjmp(png_jmpbuf(_png)))
+	return false;
+      png_write_row(_png, row);
+      return true;
+#else
+      return false;
+#endif
+    }
+
+    void finish() {
+#ifdef THREADS_HAVE_PNG
+      if (_png) {
+	if (_ok && !setjmp(png_jmpbuf(_png)))
+	  png_write_end(_png, nullptr);
+	png_destroy_write_struct(&_png, &_info);
+      }
+#endif
+    }
+
+    image_format _format;
+    int _width, _height, _band_rows;
+    // Band b waits in slot b % capacity until it's written
+    std::vector<std::vector<std::uint16_t>> _slots;
+    std::vector<bool> _full;
+    // Next band to write
+    int _next;
+    bool _ok;
+    bool _closed;
+    mutable std::mutex _mutex;
+    std::condition_variable _ready, _space;
+    std::FILE* _file;
+#ifdef THREADS_HAVE_PNG
+    png_structp _png;
+    png_infop _info;
+#endif
+    std::thread _thread;
+  };
+}
+#endif
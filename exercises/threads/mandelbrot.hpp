@@ -0,0 +1,309 @@
+#ifndef THREADS_MANDELBROT_HPP
+#define THREADS_MANDELBROT_HPP
+
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define THREADS_X86_SIMD 1
+#include <immintrin.h>
+#endif
+
+// Escape time kernels for the Mandelbrot set.
+//
+// Points are passed as separate arrays of real and imaginary parts,
+// so that a vector register can be loaded with a run of either.
+// Writing out z*z + c by hand, rather than using std::complex, also
+// avoids the checks for NaN and infinity in complex multiplication
+// that stop the compiler vectorising the loop.
+//
+// All the kernels do exactly the same arithmetic in the same order,
+// so they give the same answer. That means no fused multiply-adds,
+// which round differently: GCC would otherwise fuse across
+// statements when FMA is available (e.g. with -march=native), and
+// other compilers only fuse within one expression, so each multiply
+// is kept in a statement of its own.
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__INTEL_COMPILER)
+#pragma GCC push_options
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+namespace threads {
+
+  // The n x n grid of points c = re(i) + i im(j), 0 <= i, j < n,
+  // covering a rectangle of the complex plane with its bottom left
+  // corner at (re0, im0).
+  struct grid {
+    double re0, im0;
+    double scale_re, scale_im;
+    int n;
+
+    double re(long i) const {
+      return re0 + (scale_re * i) / n;
+    }
+    double im(long j) const {
+      return im0 + (scale_im * j) / n;
+    }
+    // Area of the rectangle
+    double area() const {
+      return scale_re * scale_im;
+    }
+  };
+
+  // Is c in the main cardioid or the period 2 bulb? Together these
+  // are most of the area of the set, and every point in them would
+  // otherwise take the full maxiter iterations.
+  inline bool in_main_bulbs(double cr, double ci) {
+    const double x = cr - 0.25, y2 = ci * ci;
+    const double q = x * x + y2;
+    if (q * (q + x) <= 0.25 * y2)
+      return true;
+    const double x1 = cr + 1.0;
+    return x1 * x1 + y2 <= 0.0625;
+  }
+
+  // Number of iterations of z = z*z + c, starting from z = c, before
+  // |z| > 2. Returns maxiter for points that don't escape, i.e. are
+  // in the set as far as we can tell.
+  //
+  // With interior = true, points in the main cardioid and bulb are
+  // spotted without iterating, and the orbit is checked for cycles
+  // with Brent's method: z is saved at iterations 1, 2, 4, 8, ...
+  // and if it ever comes back exactly to the saved value the orbit
+  // is periodic and can never escape. As the comparison is exact,
+  // this gives the same answer as iterating all the way.
+  inline int escape_count(double cr, double ci, int maxiter, bool interior = false) {
+    if (interior && in_main_bulbs(cr, ci))
+      return maxiter;
+    double zr = cr, zi = ci;
+    double saved_r = zr, saved_i = zi;
+    int steps = 0, limit = 1;
+    for (int i = 0; i < maxiter; ++i) {
+      const double zr2 = zr * zr, zi2 = zi * zi, zri = zr * zi;
+      zr = zr2 - zi2 + cr;
+      zi = zri + zri + ci;
+      const double nr = zr * zr, ni = zi * zi;
+      if (nr + ni > 4.0)
+	return i;
+      if (interior) {
+	if (zr == saved_r && zi == saved_i)
+	  return maxiter;
+	if (++steps == limit) {
+	  saved_r = zr;
+	  saved_i = zi;
+	  steps = 0;
+	  limit *= 2;
+	}
+      }
+    }
+    return maxiter;
+  }
+
+  // Instruction sets we have kernels for
+  enum class isa { scalar, avx2, avx512 };
+
+  inline const char* name(isa x) {
+    switch (x) {
+    case isa::scalar:
+      return "scalar";
+    case isa::avx2:
+      return "avx2";
+    default:
+      return "avx512";
+    }
+  }
+
+  inline bool parse_isa(const char* str, isa& x) {
+    for (auto y: {isa::scalar, isa::avx2, isa::avx512})
+      if (std::strcmp(str, name(y)) == 0) {
+	x = y;
+	return true;
+      }
+    return false;
+  }
+
+  // Can this CPU run the kernel for x?
+  inline bool supported(isa x) {
+#ifdef THREADS_X86_SIMD
+    switch (x) {
+    case isa::avx2:
+      return __builtin_cpu_supports("avx2");
+    case isa::avx512:
+      return __builtin_cpu_supports("avx512f");
+    default:
+      return true;
+    }
+#else
+    return x == isa::scalar;
+#endif
+  }
+
+  // The widest instruction set this CPU supports
+  inline isa best_isa() {
+    for (auto x: {isa::avx512, isa::avx2})
+      if (supported(x))
+	return x;
+    return isa::scalar;
+  }
+
+  namespace detail {
+    inline void escape_counts_scalar(const double* re, const double* im, int n,
+				     int maxiter, int* out, bool interior) {
+      for (int k = 0; k < n; ++k)
+	out[k] = escape_count(re[k], im[k], maxiter, interior);
+    }
+
+#ifdef THREADS_X86_SIMD
+    // Four points at once. Each lane stops counting when its point
+    // escapes, and we stop altogether once every lane has escaped.
+    // With periodicity checking, a lane whose orbit is found to cycle
+    // (see escape_count) stops too, with a count of maxiter. All the
+    // lanes take the same number of steps so can share Brent's
+    // counters.
+    __attribute__((target("avx2")))
+    inline void escape_counts_avx2(const double* re, const double* im, int n,
+				   int maxiter, int* out, bool periodicity) {
+      const __m256d four = _mm256_set1_pd(4.0);
+      const __m256d one = _mm256_set1_pd(1.0);
+      const __m256d all = _mm256_set1_pd(maxiter);
+      int k = 0;
+      for (; k + 4 <= n; k += 4) {
+	const __m256d cr = _mm256_loadu_pd(re + k);
+	const __m256d ci = _mm256_loadu_pd(im + k);
+	__m256d zr = cr, zi = ci;
+	__m256d count = _mm256_setzero_pd();
+	// All bits set in the lanes still iterating
+	__m256d active = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+	__m256d saved_r = zr, saved_i = zi;
+	int steps = 0, limit = 1;
+	for (int i = 0; i < maxiter; ++i) {
+	  const __m256d zr2 = _mm256_mul_pd(zr, zr);
+	  const __m256d zi2 = _mm256_mul_pd(zi, zi);
+	  const __m256d zri = _mm256_mul_pd(zr, zi);
+	  zr = _mm256_add_pd(_mm256_sub_pd(zr2, zi2), cr);
+	  zi = _mm256_add_pd(_mm256_add_pd(zri, zri), ci);
+	  const __m256d norm = _mm256_add_pd(_mm256_mul_pd(zr, zr), _mm256_mul_pd(zi, zi));
+	  active = _mm256_and_pd(active, _mm256_cmp_pd(norm, four, _CMP_LE_OQ));
+	  if (periodicity) {
+	    const __m256d cycled = _mm256_and_pd(active,
+	      _mm256_and_pd(_mm256_cmp_pd(zr, saved_r, _CMP_EQ_OQ),
+			    _mm256_cmp_pd(zi, saved_i, _CMP_EQ_OQ)));
+	    count = _mm256_blendv_pd(count, all, cycled);
+	    active = _mm256_andnot_pd(cycled, active);
+	    if (++steps == limit) {
+	      saved_r = zr;
+	      saved_i = zi;
+	      steps = 0;
+	      limit *= 2;
+	    }
+	  }
+	  if (_mm256_movemask_pd(active) == 0)
+	    break;
+	  count = _mm256_add_pd(count, _mm256_and_pd(active, one));
+	}
+	double c[4];
+	_mm256_storeu_pd(c, count);
+	for (int l = 0; l < 4; ++l)
+	  out[k + l] = int(c[l]);
+      }
+      escape_counts_scalar(re + k, im + k, n - k, maxiter, out + k, periodicity);
+    }
+
+    // Eight points at once, with a mask register for the live lanes
+    __attribute__((target("avx512f")))
+    inline void escape_counts_avx512(const double* re, const double* im, int n,
+				     int maxiter, int* out, bool periodicity) {
+      const __m512d four = _mm512_set1_pd(4.0);
+      const __m512i one = _mm512_set1_epi64(1);
+      const __m512i all = _mm512_set1_epi64(maxiter);
+      int k = 0;
+      for (; k + 8 <= n; k += 8) {
+	const __m512d cr = _mm512_loadu_pd(re + k);
+	const __m512d ci = _mm512_loadu_pd(im + k);
+	__m512d zr = cr, zi = ci;
+	__m512i count = _mm512_setzero_si512();
+	__mmask8 active = 0xff;
+	__m512d saved_r = zr, saved_i = zi;
+	int steps = 0, limit = 1;
+	for (int i = 0; i < maxiter; ++i) {
+	  const __m512d zr2 = _mm512_mul_pd(zr, zr);
+	  const __m512d zi2 = _mm512_mul_pd(zi, zi);
+	  const __m512d zri = _mm512_mul_pd(zr, zi);
+	  zr = _mm512_add_pd(_mm512_sub_pd(zr2, zi2), cr);
+	  zi = _mm512_add_pd(_mm512_add_pd(zri, zri), ci);
+	  const __m512d norm = _mm512_add_pd(_mm512_mul_pd(zr, zr), _mm512_mul_pd(zi, zi));
+	  active = _mm512_mask_cmp_pd_mask(active, norm, four, _CMP_LE_OQ);
+	  if (periodicity) {
+	    const __mmask8 cycled = _mm512_mask_cmp_pd_mask(
+	      _mm512_mask_cmp_pd_mask(active, zr, saved_r, _CMP_EQ_OQ), zi, saved_i, _CMP_EQ_OQ);
+	    count = _mm512_mask_mov_epi64(count, cycled, all);
+	    active &= ~cycled;
+	    if (++steps == limit) {
+	      saved_r = zr;
+	      saved_i = zi;
+	      steps = 0;
+	      limit *= 2;
+	    }
+	  }
+	  if (active == 0)
+	    break;
+	  count = _mm512_mask_add_epi64(count, active, count, one);
+	}
+	long long c[8];
+	_mm512_storeu_si512(c, count);
+	for (int l = 0; l < 8; ++l)
+	  out[k + l] = int(c[l]);
+      }
+      escape_counts_scalar(re + k, im + k, n - k, maxiter, out + k, periodicity);
+    }
+#endif
+
+    // Run one of the above on the points not in the main cardioid or
+    // bulb, gathered into a contiguous run so the vector lanes are
+    // kept busy.
+    template<class Kernel>
+    void escape_counts_interior(const double* re, const double* im, int n, int maxiter,
+				int* out, Kernel kernel) {
+      std::vector<double> rest_re, rest_im;
+      std::vector<int> where, rest_out;
+      for (int k = 0; k < n; ++k) {
+	if (in_main_bulbs(re[k], im[k])) {
+	  out[k] = maxiter;
+	} else {
+	  rest_re.push_back(re[k]);
+	  rest_im.push_back(im[k]);
+	  where.push_back(k);
+	}
+      }
+      rest_out.resize(where.size());
+      kernel(rest_re.data(), rest_im.data(), int(where.size()), maxiter, rest_out.data(), true);
+      for (std::size_t r = 0; r < where.size(); ++r)
+	out[where[r]] = rest_out[r];
+    }
+  }
+
+  // Escape counts (see escape_count) of the n points re[k] + i im[k],
+  // using the kernel for the given instruction set. Falls back to a
+  // narrower one if this CPU doesn't support it. interior turns on
+  // the cardioid/bulb test and periodicity checking.
+  inline void escape_counts(const double* re, const double* im, int n, int maxiter,
+			    int* out, isa x = best_isa(), bool interior = false) {
+    void (*kernel)(const double*, const double*, int, int, int*, bool) = detail::escape_counts_scalar;
+#ifdef THREADS_X86_SIMD
+    if (x == isa::avx512 && supported(isa::avx512))
+      kernel = detail::escape_counts_avx512;
+    else if (x != isa::scalar && supported(isa::avx2))
+      kernel = detail::escape_counts_avx2;
+#endif
+    if (interior)
+      detail::escape_counts_interior(re, im, n, maxiter, out, kernel);
+    else
+      kernel(re, im, n, maxiter, out, false);
+  }
+}
+
+#if defined(__GNUC__) && !defined(__clang__) && !defined(__INTEL_COMPILER)
+#pragma GCC pop_options
+#endif
+#endif
@@ -0,0 +1,101 @@
+#ifndef THREADS_MONTECARLO_HPP
+#define THREADS_MONTECARLO_HPP
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "mandelbrot.hpp"
+#include "philox.hpp"
+#include "reduction.hpp"
+#include "thread_pool.hpp"
+
+namespace threads {
+
+  // Estimate the fraction of a rectangle in the set by stratified
+  // Monte Carlo sampling.
+  //
+  // The rectangle is cut into the n x n cells of a grid (the strata)
+  // and each gets the same number of points, placed at random within
+  // it. With one point per cell this is jittered sampling. Compared
+  // with the regular grid it has no aliasing with the structure of the
+  // set, and comes with an honest error estimate; compared with plain
+  // Monte Carlo the error is much smaller, as it only comes from cells
+  // the boundary passes through.
+  //
+  // Random numbers come from Philox, with the counter made from the
+  // cell and sample number, so every point is the same whichever
+  // thread does it, and the answer only depends on the seed.
+  //
+  // The standard error is from the variance within each cell,
+  // m (k - m) / (k^2 (k - 1)) for m of k points inside. With only one
+  // point per cell that can't be estimated, so neighbouring pairs of
+  // cells are taken together as one stratum ("collapsed strata"),
+  // which overestimates the error a little.
+  struct sample_estimate {
+    long samples;
+    long inside;
+    // Fraction of the rectangle in the set, and its standard error
+    double fraction;
+    double error;
+  };
+
+  inline sample_estimate stratified_sample(thread_pool& pool, const grid& g, int samples,
+					   std::uint64_t seed, int maxiter, isa kernel,
+					   bool interior, schedule sched, std::size_t chunk) {
+    const philox rng(seed);
+    const int n = g.n;
+    // Both sums are of integers, so the answer doesn't depend on the
+    // order in which the threads' parts are added.
+    reduction<long> inside(pool.size()), spread(pool.size());
+    parallel_for(pool, n, sched, chunk, [&](std::size_t begin, std::size_t end, unsigned t) {
+	const int k = samples;
+	std::vector<double> re(std::size_t(n) * k), im(std::size_t(n) * k);
+	std::vector<int> iters(re.size());
+	std::vector<int> count(n);
+	for (auto i = begin; i < end; ++i) {
+	  for (int j = 0; j < n; ++j) {
+	    for (int s = 0; s < k; ++s) {
+	      const auto r = rng(philox::counter{{std::uint32_t(i), std::uint32_t(j),
+						  std::uint32_t(s), 0}});
+	      const std::size_t p = std::size_t(j) * k + s;
+	      re[p] = g.re(i) + g.scale_re * philox::uniform(r[0], r[1]) / n;
+	      im[p] = g.im(j) + g.scale_im * philox::uniform(r[2], r[3]) / n;
+	    }
+	  }
+	  escape_counts(re.data(), im.data(), int(re.size()), maxiter, iters.data(),
+			kernel, interior);
+	  for (int j = 0; j < n; ++j) {
+	    count[j] = 0;
+	    for (int s = 0; s < k; ++s)
+	      count[j] += iters[std::size_t(j) * k + s] == maxiter;
+	    inside[t] += count[j];
+	  }
+	  if (k > 1) {
+	    for (int j = 0; j < n; ++j)
+	      spread[t] += long(count[j]) * (k - count[j]);
+	  } else {
+	    // The variance of the sum of a pair is about (y_a - y_b)^2.
+	    // With an odd number of cells the last one is paired with the
+	    // one before it again.
+	    for (int j = 0; j + 1 < n; j += 2)
+	      spread[t] += count[j] != count[j + 1];
+	    if (n % 2 == 1 && n > 1)
+	      spread[t] += count[n - 1] != count[n - 2];
+	  }
+	}
+      });
+
+    sample_estimate ans;
+    const double cells = double(n) * n;
+    ans.samples = long(n) * n * samples;
+    ans.inside = inside.result();
+    ans.fraction = double(ans.inside) / ans.samples;
+    const double s = double(spread.result());
+    const double variance = samples > 1 ?
+      s / (double(samples) * samples * (samples - 1)) : s;
+    ans.error = std::sqrt(variance) / cells;
+    return ans;
+  }
+}
+#endif
@@ -0,0 +1,22 @@
+#!/bin/bash
+#
+# Check that the MPI version gets the same area as the threaded one
+# on 1 to 4 processes.
+#
+# Usage: ./mpi_check.sh [options for both]
+#
+# Extra arguments for mpirun can be given in MPIRUN_ARGS, e.g.
+# "--oversubscribe" to run more processes than cores with Open MPI.
+
+expected=$(./area "$@" | grep '^Area')
+echo "threads: $expected"
+status=0
+for np in 1 2 3 4; do
+    got=$(mpirun $MPIRUN_ARGS -np $np ./area_mpi "$@" | grep '^Area')
+    echo "np = $np: $got"
+    if [ "$got" != "$expected" ]; then
+	echo "MISMATCH"
+	status=1
+    fi
+done
+exit $status
@@ -0,0 +1,244 @@
+#ifndef THREADS_PERTURBATION_HPP
+#define THREADS_PERTURBATION_HPP
+
+#include <cctype>
+#include <cmath>
+#include <complex>
+#include <cstdlib>
+#include <vector>
+
+// Deep zoom by perturbation theory.
+//
+// Doubles only have 53 bits, so once the pixels are closer together
+// than about 1e-13 of their distance from 0, neighbouring c values
+// round to the same number. Instead we compute the orbit Z_n of the
+// centre C of the view in higher precision (double-double), once,
+// and for each pixel c = C + dc iterate only the difference
+// dz_n = z_n - Z_n in double:
+//
+//   dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc
+//
+// dz and dc are tiny, but doubles have plenty of exponent range, so
+// this keeps full relative precision.
+//
+// NB: the double-double arithmetic relies on the compiler not
+// reassociating floating point operations, so this must not be built
+// with -ffast-math (or Intel's -fp-model fast).
+namespace threads {
+
+  // An unevaluated sum hi + lo of two doubles with |lo| <= ulp(hi)/2,
+  // giving about 106 bits of precision.
+  struct dd {
+    double hi, lo;
+
+    dd(double h = 0.0, double l = 0.0) : hi(h), lo(l) {
+    }
+    double to_double() const {
+      return hi + lo;
+    }
+  };
+
+  namespace detail {
+    // a + b = s + err exactly, for any a, b
+    inline dd two_sum(double a, double b) {
+      const double s = a + b;
+      const double bb = s - a;
+      return dd(s, (a - (s - bb)) + (b - bb));
+    }
+    // Same, but needs |a| >= |b|
+    inline dd quick_two_sum(double a, double b) {
+      const double s = a + b;
+      return dd(s, b - (s - a));
+    }
+    // a * b = p + err exactly
+    inline dd two_prod(double a, double b) {
+      const double p = a * b;
+      return dd(p, std::fma(a, b, -p));
+    }
+  }
+
+  inline dd operator+(const dd& a, const dd& b) {
+    dd s = detail::two_sum(a.hi, b.hi);
+    const dd t = detail::two_sum(a.lo, b.lo);
+    s.lo += t.hi;
+    s = detail::quick_two_sum(s.hi, s.lo);
+    s.lo += t.lo;
+    return detail::quick_two_sum(s.hi, s.lo);
+  }
+  inline dd operator-(const dd& a) {
+    return dd(-a.hi, -a.lo);
+  }
+  inline dd operator-(const dd& a, const dd& b) {
+    return a + (-b);
+  }
+  inline dd operator*(const dd& a, const dd& b) {
+    dd p = detail::two_prod(a.hi, b.hi);
+    p.lo += a.hi * b.lo + a.lo * b.hi;
+    return detail::quick_two_sum(p.hi, p.lo);
+  }
+  inline dd operator/(const dd& a, double b) {
+    const double q1 = a.hi / b;
+    const dd r = a - detail::two_prod(q1, b);
+    return detail::quick_two_sum(q1, r.hi / b);
+  }
+
+  // Read a decimal number like "-0.7436438870371587047521915e0" to
+  // full double-double precision. Returns false if it isn't one.
+  inline bool parse_dd(const char* str, dd& x) {
+    const char* p = str;
+    bool negative = false;
+    if (*p == '+' || *p == '-')
+      negative = *p++ == '-';
+    dd ans;
+    int exponent = 0;
+    bool digits = false, point = false;
+    for (; std::isdigit(*p) || (*p == '.' && !point); ++p) {
+      if (*p == '.') {
+	point = true;
+	continue;
+      }
+      ans = ans * dd(10.0) + dd(*p - '0');
+      digits = true;
+      if (point)
+	--exponent;
+    }
+    if (!digits)
+      return false;
+    if (*p == 'e' || *p == 'E') {
+      char* end;
+      exponent += std::strtol(p + 1, &end, 10);
+      p = end;
+    }
+    if (*p != '\0')
+      return false;
+    for (; exponent > 0; --exponent)
+      ans = ans * dd(10.0);
+    for (; exponent < 0; ++exponent)
+      ans = ans / 10.0;
+    x = negative ? -ans : ans;
+    return true;
+  }
+
+  // Escape counts for pixels c = C + dc near a centre C, by
+  // perturbation from the orbit of C.
+  //
+  // The early iterations of every pixel are skipped using a series
+  // approximation, dz_n ~ A_n dc + B_n dc^2 + C_n dc^3, whose
+  // coefficients only depend on the reference orbit. We skip for as
+  // long as the next term would be negligible for all the pixels.
+  //
+  // A pixel "glitches" when its z_n gets much closer to 0 than Z_n
+  // is, since dz then loses its relative precision. We detect this
+  // as |z_n| < |dz_n| and rebase: carry on with dz = z_n against the
+  // reference orbit from its start (Z_0 = 0). The same is done when
+  // a pixel outlives the reference orbit. So one reference serves
+  // all pixels.
+  //
+  // Counts follow escape_count in mandelbrot.hpp, so maxiter means
+  // inside.
+  class perturbation {
+  public:
+    // Reference orbit of the centre, and the series approximation for
+    // pixels with |dc| <= radius.
+    perturbation(const dd& centre_re, const dd& centre_im, int maxiter, double radius)
+      : _maxiter(maxiter), _skip(0) {
+      // escape_count starts from z = c, i.e. z_1 with z_0 = 0, and
+      // checks up to z_{maxiter+1}
+      const int last = maxiter + 1;
+      dd zr, zi;
+      _orbit.push_back(complex(0, 0));
+      for (int n = 0; n < last; ++n) {
+	const dd zr2 = zr * zr, zi2 = zi * zi, zri = zr * zi;
+	zr = zr2 - zi2 + centre_re;
+	zi = zri + zri + centre_im;
+	const complex z(zr.to_double(), zi.to_double());
+	_orbit.push_back(z);
+	if (std::norm(z) > 4.0)
+	  break;
+      }
+      series(radius);
+    }
+
+    // Length of the reference orbit, and the iterations skipped for
+    // every pixel
+    int orbit_length() const {
+      return int(_orbit.size()) - 1;
+    }
+    int skipped() const {
+      return _skip;
+    }
+
+    // Escape count of c = centre + (dcr + i dci). rebases is
+    // incremented for each glitch avoided.
+    int escape_count(double dcr, double dci, long& rebases) const {
+      const int last = _maxiter + 1;
+      const int length = orbit_length();
+      const complex dc(dcr, dci);
+      complex dz = _a * dc + _b * dc * dc + _c * dc * dc * dc;
+      double dzr = dz.real(), dzi = dz.imag();
+      int m = _skip;
+      for (int n = _skip; ; ++n, ++m) {
+	const double zr = _orbit[m].real() + dzr, zi = _orbit[m].imag() + dzi;
+	const double r2 = zr * zr + zi * zi;
+	if (r2 > 4.0)
+	  return n < 2 ? 0 : n - 2;
+	if (n == last)
+	  return _maxiter;
+	if (r2 < dzr * dzr + dzi * dzi || m == length) {
+	  dzr = zr;
+	  dzi = zi;
+	  m = 0;
+	  ++rebases;
+	}
+	// dz = (2 Z + dz) dz + dc
+	const double tr = 2.0 * _orbit[m].real() + dzr, ti = 2.0 * _orbit[m].imag() + dzi;
+	const double nr = tr * dzr - ti * dzi + dcr;
+	const double ni = tr * dzi + ti * dzr + dci;
+	dzr = nr;
+	dzi = ni;
+      }
+    }
+
+  private:
+    using complex = std::complex<double>;
+
+    // Find how far the series approximation holds for |dc| <= r. We
+    // carry one more term, D_n dc^4, as an estimate of the error in
+    // leaving it out, and stop once that could be more than tolerance
+    // times the linear term. The coefficients grow quickly once pixels
+    // in the view start to escape, so that stops us in time for those
+    // too.
+    void series(double r) {
+      const double tolerance = 1e-14;
+      complex a(0, 0), b(0, 0), c(0, 0), d(0, 0);
+      _a = a;
+      _b = b;
+      _c = c;
+      for (int n = 0; n + 1 < orbit_length(); ++n) {
+	const complex z2 = 2.0 * _orbit[n];
+	const complex na = z2 * a + 1.0;
+	const complex nb = z2 * b + a * a;
+	const complex nc = z2 * c + 2.0 * a * b;
+	const complex nd = z2 * d + 2.0 * a * c + b * b;
+	if (std::abs(nd) * r * r * r > tolerance * std::abs(na))
+	  break;
+	a = na;
+	b = nb;
+	c = nc;
+	d = nd;
+	_skip = n + 1;
+      }
+      _a = a;
+      _b = b;
+      _c = c;
+    }
+
+    int _maxiter;
+    // Reference orbit Z_0 = 0, Z_1 = C, ... rounded to double
+    std::vector<complex> _orbit;
+    // Series coefficients at iteration _skip
+    int _skip;
+    complex _a, _b, _c;
+  };
+}
+#endif
@@ -0,0 +1,53 @@
+#ifndef THREADS_PHILOX_HPP
+#define THREADS_PHILOX_HPP
+
+#include <array>
+#include <cstdint>
+
+namespace threads {
+
+  // The Philox4x32-10 counter-based random number generator (Salmon et
+  // al., "Parallel random numbers: as easy as 1, 2, 3", SC11).
+  //
+  // Rather than stepping a state along, it's a function from a 128 bit
+  // counter and a 64 bit key to 128 random bits. So any thread can
+  // make the numbers for any part of a computation directly, just by
+  // picking the counter, and gets exactly the same numbers whichever
+  // thread does it and in whatever order. Different keys give
+  // independent streams.
+  class philox {
+  public:
+    using counter = std::array<std::uint32_t, 4>;
+    using key = std::array<std::uint32_t, 2>;
+
+    explicit philox(std::uint64_t seed)
+      : _key{{std::uint32_t(seed), std::uint32_t(seed >> 32)}} {
+    }
+
+    // The four random words for counter c
+    counter operator()(counter c) const {
+      key k = _key;
+      for (int r = 0; r < 10; ++r) {
+	if (r > 0) {
+	  k[0] += 0x9E3779B9;
+	  k[1] += 0xBB67AE85;
+	}
+	const std::uint64_t p0 = std::uint64_t(0xD2511F53) * c[0];
+	const std::uint64_t p1 = std::uint64_t(0xCD9E8D57) * c[2];
+	c = counter{{std::uint32_t(p1 >> 32) ^ c[1] ^ k[0], std::uint32_t(p1),
+		     std::uint32_t(p0 >> 32) ^ c[3] ^ k[1], std::uint32_t(p0)}};
+      }
+      return c;
+    }
+
+    // A double uniform on [0, 1) from two of the words
+    static double uniform(std::uint32_t hi, std::uint32_t lo) {
+      const std::uint64_t bits = (std::uint64_t(hi) << 32 | lo) >> 11;
+      return double(bits) * (1.0 / 9007199254740992.0);
+    }
+
+  private:
+    key _key;
+  };
+}
+#endif
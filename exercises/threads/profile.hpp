@@ -0,0 +1,160 @@
+#ifndef THREADS_PROFILE_HPP
+#define THREADS_PROFILE_HPP
+
+#include <algorithm>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mandelbrot.hpp"
+
+namespace threads {
+
+  // How much work each row of a grid takes, measured on an earlier run
+  // and kept on disk, so later runs over the same region can share the
+  // rows out between threads in blocks of equal cost up front, rather
+  // than paying for dynamic scheduling.
+  //
+  // The cost of a row is the number of iterations done on it (plus
+  // one per point for the overhead), counted from the escape counts.
+  // A profile is for a region, maxiter and whether the interior tests
+  // are on, but not the resolution: costs are stored per row of the
+  // grid they were measured on, and for a different number of rows the
+  // cumulative cost is interpolated.
+  //
+  // NB:
+  //
+  //  - with the interior tests on, points found to be periodic are
+  //    still counted as costing maxiter, so the costs are only rough
+  //
+  //  - profiles are files named after a hash of the key, in a
+  //    directory; the key is stored in the file too and checked on
+  //    loading
+  class cost_profile {
+  public:
+    cost_profile(const grid& g, int maxiter, bool interior)
+      : _maxiter(maxiter), _interior(interior) {
+      char buf[256];
+      std::snprintf(buf, sizeof(buf), "re0=%a im0=%a scale_re=%a scale_im=%a maxiter=%d interior=%d",
+		    g.re0, g.im0, g.scale_re, g.scale_im, maxiter, int(interior));
+      _key = buf;
+    }
+
+    const std::string& key() const {
+      return _key;
+    }
+    bool empty() const {
+      return _costs.empty();
+    }
+
+    // Cost of one row, given its escape counts
+    double row_cost(const grid& g, long i, const int* iters) const {
+      double cost = 0;
+      for (int j = 0; j < g.n; ++j) {
+	// Points in the main cardioid and bulb are never iterated
+	if (_interior && iters[j] == _maxiter && in_main_bulbs(g.re(i), g.im(j)))
+	  continue;
+	cost += iters[j] + 1;
+      }
+      return cost;
+    }
+
+    // Set the cost of each row, e.g. from row_cost
+    void record(std::vector<double> costs) {
+      _costs = std::move(costs);
+    }
+
+    // Split n rows into parts contiguous blocks of about equal cost.
+    // Returns the parts + 1 boundaries.
+    std::vector<std::size_t> partition(std::size_t n, unsigned parts) const {
+      // Cumulative cost at the start of each of the n rows, found from
+      // the piecewise linear cumulative cost of the profile's rows
+      const std::size_t m = _costs.size();
+      std::vector<double> measured(m + 1, 0.0);
+      for (std::size_t k = 0; k < m; ++k)
+	measured[k + 1] = measured[k] + _costs[k];
+      std::vector<double> total(n + 1);
+      for (std::size_t i = 0; i <= n; ++i) {
+	const double x = double(i) * m / n;
+	const std::size_t k = std::min<std::size_t>(std::size_t(x), m - 1);
+	total[i] = measured[k] + (x - k) * _costs[k];
+      }
+
+      std::vector<std::size_t> bounds(parts + 1);
+      bounds[0] = 0;
+      bounds[parts] = n;
+      for (unsigned t = 1; t < parts; ++t) {
+	const double target = total[n] * t / parts;
+	bounds[t] = std::lower_bound(total.begin(), total.end(), target) - total.begin();
+	bounds[t] = std::max(bounds[t - 1], std::min(bounds[t], n));
+      }
+      return bounds;
+    }
+
+    // File name for this profile in dir
+    std::string filename(const std::string& dir) const {
+      // 64 bit FNV-1a
+      std::uint64_t hash = 0xcbf29ce484222325ULL;
+      for (char c: _key) {
+	hash ^= static_cast<unsigned char>(c);
+	hash *= 0x100000001b3ULL;
+      }
+      char name[64];
+      std::snprintf(name, sizeof(name), "/profile-%016" PRIx64 ".txt", hash);
+      return dir + name;
+    }
+
+    // Read the profile from dir, returning false if there isn't one
+    bool load(const std::string& dir) {
+      std::FILE* f = std::fopen(filename(dir).c_str(), "r");
+      if (!f)
+	return false;
+      char line[256];
+      std::size_t m = 0;
+      bool ok = std::fgets(line, sizeof(line), f) && _key + "\n" == line &&
+	std::fscanf(f, "%zu", &m) == 1 && m > 0;
+      std::vector<double> costs(ok ? m : 0);
+      for (std::size_t k = 0; ok && k < m; ++k)
+	ok = std::fscanf(f, "%la", &costs[k]) == 1;
+      std::fclose(f);
+      if (ok)
+	_costs = std::move(costs);
+      return ok;
+    }
+
+    // Write the profile to dir, creating it if need be. The file is
+    // written under a temporary name and renamed into place, so
+    // another run reading it never sees half a profile.
+    bool save(const std::string& dir) const {
+      if (::mkdir(dir.c_str(), 0777) != 0 && errno != EEXIST)
+	return false;
+      const std::string name = filename(dir);
+      const std::string tmp = name + ".tmp" + std::to_string(::getpid());
+      std::FILE* f = std::fopen(tmp.c_str(), "w");
+      if (!f)
+	return false;
+      bool ok = std::fprintf(f, "%s\n%zu\n", _key.c_str(), _costs.size()) > 0;
+      for (auto c: _costs)
+	ok = ok && std::fprintf(f, "%a\n", c) > 0;
+      ok = std::fclose(f) == 0 && ok;
+      if (ok)
+	ok = std::rename(tmp.c_str(), name.c_str()) == 0;
+      if (!ok)
+	std::remove(tmp.c_str());
+      return ok;
+    }
+
+  private:
+    int _maxiter;
+    bool _interior;
+    std::string _key;
+    std::vector<double> _costs;
+  };
+}
+#endif
@@ -0,0 +1,108 @@
+#ifndef THREADS_PROGRESSIVE_HPP
+#define THREADS_PROGRESSIVE_HPP
+
+#include <vector>
+
+#include "mandelbrot.hpp"
+#include "reduction.hpp"
+#include "thread_pool.hpp"
+
+namespace threads {
+
+  // Count the points of a grid in the set, then of grids with twice,
+  // four times, ... as many points along each side, reusing the work
+  // done on the coarser ones.
+  //
+  // Point (i, j) of an n x n grid is exactly point (2i, 2j) of the
+  // 2n x 2n grid over the same region (multiplying by 2 is exact in
+  // floating point), so we keep the escape count of every point and
+  // only iterate the three quarters of each new grid that are new.
+  //
+  // NB: this keeps an int per point of the finest grid so far, which
+  // limits how far it can go.
+  class progressive {
+  public:
+    progressive(const grid& g, int maxiter, isa kernel, bool interior)
+      : _grid(g), _maxiter(maxiter), _kernel(kernel), _interior(interior),
+	_inside(0), _iterated(0) {
+      _grid.n = 0;
+    }
+
+    // Current grid, and the number of points of it inside the set
+    const grid& current() const {
+      return _grid;
+    }
+    long inside() const {
+      return _inside;
+    }
+    // Points iterated at the last step
+    long iterated() const {
+      return _iterated;
+    }
+    // Escape count of point (i, j) of the current grid
+    int escape_count(int i, int j) const {
+      return _counts[long(i) * _grid.n + j];
+    }
+
+    // Do the grid with n points along each side. The first call can
+    // be any size, after that it has to double each time.
+    void first(thread_pool& pool, int n) {
+      _grid.n = n;
+      _counts.assign(long(n) * n, 0);
+      compute(pool, false);
+    }
+    void refine(thread_pool& pool) {
+      const int n = _grid.n;
+      std::vector<int> coarse(long(2 * n) * (2 * n));
+      coarse.swap(_counts);
+      _grid.n = 2 * n;
+      // Copy the old points into place
+      parallel_for(pool, n, schedule::static_, 0, [&](std::size_t b, std::size_t e, unsigned) {
+	  for (std::size_t i = b; i < e; ++i)
+	    for (int j = 0; j < n; ++j)
+	      _counts[long(2 * i) * (2 * n) + 2 * j] = coarse[long(i) * n + j];
+	});
+      compute(pool, true);
+    }
+
+  private:
+    // Iterate the points of the current grid, skipping even (i, j)
+    // if we know them already, and count the inside ones.
+    void compute(thread_pool& pool, bool skip_even) {
+      const int n = _grid.n;
+      reduction<long> inside(pool.size()), iterated(pool.size());
+      parallel_for(pool, n, schedule::dynamic, 1, [&](std::size_t i, std::size_t, unsigned t) {
+	  // Even rows only need their odd columns
+	  const bool half = skip_even && i % 2 == 0;
+	  const int step = half ? 2 : 1;
+	  std::vector<double> re, im;
+	  for (int j = half ? 1 : 0; j < n; j += step) {
+	    re.push_back(_grid.re(i));
+	    im.push_back(_grid.im(j));
+	  }
+	  std::vector<int> iters(re.size());
+	  escape_counts(re.data(), im.data(), int(re.size()), _maxiter, iters.data(),
+			_kernel, _interior);
+	  int* row = _counts.data() + long(i) * n;
+	  for (std::size_t k = 0; k < iters.size(); ++k)
+	    row[(half ? 1 : 0) + step * k] = iters[k];
+	  long in = 0;
+	  for (int j = 0; j < n; ++j)
+	    in += row[j] == _maxiter;
+	  inside[t] += in;
+	  iterated[t] += iters.size();
+	});
+      _inside = inside.result();
+      _iterated = iterated.result();
+    }
+
+    grid _grid;
+    int _maxiter;
+    isa _kernel;
+    bool _interior;
+    std::vector<int> _counts;
+    long _inside;
+    long _iterated;
+  };
+}
+#endif
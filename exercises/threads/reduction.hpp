@@ -0,0 +1,157 @@
+#ifndef THREADS_REDUCTION_HPP
+#define THREADS_REDUCTION_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace threads {
+
+  // Size of a cache line, as far as sharing between threads goes. Not
+  // every standard library has the C++17 constant yet. GCC warns that
+  // its value depends on -mtune, which only matters if it's part of an
+  // ABI, and here it isn't.
+#ifdef __cpp_lib_hardware_interference_size
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Winterference-size"
+#endif
+  constexpr std::size_t cache_line = std::hardware_destructive_interference_size;
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#else
+  constexpr std::size_t cache_line = 64;
+#endif
+
+  // A T on a cache line of its own, so writes to it from one thread
+  // don't invalidate anything another thread is using
+  template<class T>
+  struct alignas(cache_line) padded {
+    T value;
+  };
+
+  // Allocator for things that must start on a cache line. Before
+  // C++17, new (and so std::allocator) ignores alignments bigger than
+  // that of max_align_t, so line the block up by hand.
+  template<class T>
+  struct cache_aligned_allocator {
+    using value_type = T;
+
+    cache_aligned_allocator() = default;
+    template<class U>
+    cache_aligned_allocator(const cache_aligned_allocator<U>&) {
+    }
+
+    T* allocate(std::size_t n) {
+      // Room to line up, and to remember where the block started
+      void* raw = ::operator new(n * sizeof(T) + cache_line + sizeof(void*));
+      const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(raw) + sizeof(void*);
+      void** p = reinterpret_cast<void**>((start + cache_line - 1) & ~std::uintptr_t(cache_line - 1));
+      p[-1] = raw;
+      return reinterpret_cast<T*>(p);
+    }
+    void deallocate(T* p, std::size_t) {
+      ::operator delete(reinterpret_cast<void**>(p)[-1]);
+    }
+  };
+  template<class T, class U>
+  bool operator==(const cache_aligned_allocator<T>&, const cache_aligned_allocator<U>&) {
+    return true;
+  }
+  template<class T, class U>
+  bool operator!=(const cache_aligned_allocator<T>&, const cache_aligned_allocator<U>&) {
+    return false;
+  }
+
+  // Reduce values from several threads without them ever sharing a
+  // counter (which serialises them, whether it's protected by a mutex
+  // or atomic) or a cache line (false sharing, which is as bad).
+  //
+  // Each thread t adds into its own accumulator, (*this)[t], and the
+  // accumulators are then combined pairwise as a binary tree: thread
+  // t + 1 into t, t + 2 into t, t + 4 into t, ... This takes log2(n)
+  // steps rather than n, and always combines in the same order, so
+  // floating point sums are reproducible.
+  //
+  // Either call combine(t) on every thread when it's done, and thread
+  // 0 gets the answer back once the rest have arrived, or call
+  // result() after they've all finished.
+  //
+  // NB:
+  //
+  //  - accumulators need to be reset() before the reduction is used
+  //    again
+  //
+  //  - op must be associative, and identity its identity element
+  template<class T, class Op = std::plus<T>>
+  class reduction {
+  public:
+    explicit reduction(unsigned nthreads, T identity = T(), Op op = Op())
+      : _identity(identity), _op(op), _acc(nthreads), _ready(nthreads) {
+      reset();
+    }
+
+    reduction(const reduction&) = delete;
+    reduction& operator=(const reduction&) = delete;
+
+    unsigned size() const {
+      return _acc.size();
+    }
+
+    // Thread t's accumulator
+    T& operator[](unsigned t) {
+      return _acc[t].value;
+    }
+
+    void reset() {
+      for (std::size_t t = 0; t < _acc.size(); ++t) {
+	_acc[t].value = _identity;
+	_ready[t].value.store(false, std::memory_order_relaxed);
+      }
+    }
+
+    // Called by thread t once it has finished with its accumulator.
+    // Waits for the threads below it in the tree, so it must be called
+    // on all of them. Returns the total on thread 0 and this thread's
+    // part of it elsewhere.
+    T combine(unsigned t) {
+      const unsigned n = _acc.size();
+      for (unsigned step = 1; step < n; step *= 2) {
+	if (t % (2 * step) != 0)
+	  break;
+	const unsigned partner = t + step;
+	if (partner >= n)
+	  continue;
+	// Other threads may be waiting for cores, so don't just spin
+	while (!_ready[partner].value.load(std::memory_order_acquire))
+	  std::this_thread::yield();
+	_acc[t].value = _op(_acc[t].value, _acc[partner].value);
+      }
+      _ready[t].value.store(true, std::memory_order_release);
+      return _acc[t].value;
+    }
+
+    // Combine the accumulators after the threads have finished
+    T result() const {
+      std::vector<T> acc(_acc.size());
+      for (std::size_t t = 0; t < acc.size(); ++t)
+	acc[t] = _acc[t].value;
+      for (std::size_t step = 1; step < acc.size(); step *= 2)
+	for (std::size_t t = 0; t + step < acc.size(); t += 2 * step)
+	  acc[t] = _op(acc[t], acc[t + step]);
+      return acc.empty() ? _identity : acc[0];
+    }
+
+  private:
+    T _identity;
+    Op _op;
+    std::vector<padded<T>, cache_aligned_allocator<padded<T>>> _acc;
+    std::vector<padded<std::atomic<bool>>, cache_aligned_allocator<padded<std::atomic<bool>>>> _ready;
+  };
+}
+#endif
@@ -0,0 +1,181 @@
+#ifndef THREADS_SUBDIVIDE_HPP
+#define THREADS_SUBDIVIDE_HPP
+
+#include <atomic>
+#include <functional>
+#include <vector>
+
+#include "mandelbrot.hpp"
+#include "reduction.hpp"
+#include "thread_pool.hpp"
+
+namespace threads {
+
+  // Count the points of a grid in the Mandelbrot set by rectangle
+  // subdivision (the Mariani-Silver algorithm).
+  //
+  // The set is connected, and so are the bands of points outside it
+  // with the same escape count. So if every point on the border of a
+  // rectangle has the same escape count (or is inside), then so do
+  // the points within it, unless there's a feature too thin to be
+  // seen at the grid spacing, and they can be filled in without
+  // iterating. Otherwise the rectangle is cut into four and each
+  // piece is a new task. Only points near the boundary of the set or
+  // of a band get iterated, which for big grids is a small fraction.
+  //
+  // Using the exact escape count, rather than just inside/outside,
+  // makes it much less likely to fill over a small part of the set,
+  // as the bands get narrow near one.
+  //
+  // NB:
+  //
+  //  - the count can still differ slightly from the brute force one
+  //
+  //  - this needs an int per grid point for the escape counts
+  class subdivider {
+  public:
+    // Rectangles with sides smaller than this are just iterated
+    static const int min_side = 8;
+
+    subdivider(const grid& g, int maxiter, isa kernel, bool interior)
+      : _grid(g), _maxiter(maxiter), _kernel(kernel), _interior(interior),
+	_state(std::size_t(g.n) * g.n), _iterated(0) {
+      for (auto& s: _state)
+	s.store(unknown, std::memory_order_relaxed);
+    }
+
+    // Do the work on the pool and return the number of points inside
+    long count(thread_pool& pool) {
+      const int n = _grid.n;
+      if (n == 0)
+	return 0;
+      std::vector<rect> top = {{0, n - 1, 0, n - 1}};
+      // Start off with the outer border
+      std::vector<long> pts;
+      border(top[0], pts);
+      evaluate(pts);
+
+      parallel_tasks(pool, top, [this](const rect& r, unsigned, std::function<void(rect)> spawn) {
+	  split(r, spawn);
+	});
+
+      reduction<long> counts(pool.size());
+      parallel_for(pool, n, schedule::static_, 0, [&](std::size_t b, std::size_t e, unsigned t) {
+	  long inside = 0;
+	  for (std::size_t k = b * n; k < e * n; ++k)
+	    inside += _state[k].load(std::memory_order_relaxed) == _maxiter;
+	  counts[t] += inside;
+	});
+      return counts.result();
+    }
+
+    // Escape count of grid point (i, j); maxiter means inside. Only
+    // valid after count().
+    int escape_count(int i, int j) const {
+      return _state[index(i, j)].load(std::memory_order_relaxed);
+    }
+
+    // Number of points that were actually iterated
+    long iterated() const {
+      return _iterated;
+    }
+
+  private:
+    // Escape count of a point we haven't looked at yet
+    static const int unknown = -1;
+
+    // Points i0 <= i <= i1, j0 <= j <= j1, including the border
+    struct rect {
+      int i0, i1, j0, j1;
+    };
+
+    long index(int i, int j) const {
+      return long(i) * _grid.n + j;
+    }
+
+    // Add the border points of r to pts
+    void border(const rect& r, std::vector<long>& pts) const {
+      for (int j = r.j0; j <= r.j1; ++j) {
+	pts.push_back(index(r.i0, j));
+	if (r.i1 != r.i0)
+	  pts.push_back(index(r.i1, j));
+      }
+      for (int i = r.i0 + 1; i < r.i1; ++i) {
+	pts.push_back(index(i, r.j0));
+	if (r.j1 != r.j0)
+	  pts.push_back(index(i, r.j1));
+      }
+    }
+
+    // Work out which of the points pts are in the set, if we don't
+    // know already
+    void evaluate(const std::vector<long>& pts) {
+      std::vector<double> re, im;
+      std::vector<long> todo;
+      for (auto p: pts)
+	if (_state[p].load(std::memory_order_relaxed) == unknown) {
+	  todo.push_back(p);
+	  re.push_back(_grid.re(p / _grid.n));
+	  im.push_back(_grid.im(p % _grid.n));
+	}
+      std::vector<int> iters(todo.size());
+      escape_counts(re.data(), im.data(), int(todo.size()), _maxiter, iters.data(),
+		    _kernel, _interior);
+      for (std::size_t k = 0; k < todo.size(); ++k)
+	_state[todo[k]].store(iters[k], std::memory_order_relaxed);
+      _iterated += todo.size();
+    }
+
+    // Handle a rectangle whose border is known
+    void split(const rect& r, const std::function<void(rect)>& spawn) {
+      if (r.i1 - r.i0 < 2 || r.j1 - r.j0 < 2)
+	return;
+
+      std::vector<long> pts;
+      border(r, pts);
+      const int first = _state[pts[0]].load(std::memory_order_relaxed);
+      bool same = true;
+      for (auto p: pts)
+	same = same && _state[p].load(std::memory_order_relaxed) == first;
+      if (same) {
+	for (int i = r.i0 + 1; i < r.i1; ++i)
+	  for (int j = r.j0 + 1; j < r.j1; ++j)
+	    _state[index(i, j)].store(first, std::memory_order_relaxed);
+	return;
+      }
+
+      pts.clear();
+      if (r.i1 - r.i0 <= min_side || r.j1 - r.j0 <= min_side) {
+	for (int i = r.i0 + 1; i < r.i1; ++i)
+	  for (int j = r.j0 + 1; j < r.j1; ++j)
+	    pts.push_back(index(i, j));
+	evaluate(pts);
+	return;
+      }
+
+      // Work out the cross through the middle, which is the shared
+      // border of the four quarters
+      const int im = (r.i0 + r.i1) / 2, jm = (r.j0 + r.j1) / 2;
+      for (int j = r.j0 + 1; j < r.j1; ++j)
+	pts.push_back(index(im, j));
+      for (int i = r.i0 + 1; i < r.i1; ++i)
+	if (i != im)
+	  pts.push_back(index(i, jm));
+      evaluate(pts);
+
+      spawn(rect{r.i0, im, r.j0, jm});
+      spawn(rect{r.i0, im, jm, r.j1});
+      spawn(rect{im, r.i1, r.j0, jm});
+      spawn(rect{im, r.i1, jm, r.j1});
+    }
+
+    grid _grid;
+    int _maxiter;
+    isa _kernel;
+    bool _interior;
+    // Escape count of each point, or unknown
+    std::vector<std::atomic<int>> _state;
+    std::atomic<long> _iterated;
+  };
+}
+#endif
@@ -0,0 +1,234 @@
+#ifndef THREADS_THREAD_POOL_HPP
+#define THREADS_THREAD_POOL_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace threads {
+
+  // A fixed set of threads that can be asked to run a job over and
+  // over, so we don't pay for creating threads on every loop.
+  //
+  // The thread calling run() takes part as thread 0, so a pool of
+  // size 1 has no extra threads at all.
+  //
+  // NB:
+  //
+  //  - only one thread may call run() at a time
+  //
+  //  - the pool can't be copied or moved, as the workers hold a
+  //    pointer to it
+  class thread_pool {
+  public:
+    // 0 threads means one per core
+    explicit thread_pool(unsigned nthreads = 0)
+      : _size(nthreads ? nthreads : std::max(1U, std::thread::hardware_concurrency())),
+	_job(nullptr), _generation(0), _running(0), _stop(false) {
+      for (unsigned t = 1; t < _size; ++t)
+	_workers.emplace_back(&thread_pool::work, this, t);
+    }
+
+    thread_pool(const thread_pool&) = delete;
+    thread_pool& operator=(const thread_pool&) = delete;
+
+    ~thread_pool() {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_stop = true;
+      }
+      _start.notify_all();
+      for (auto& w: _workers)
+	w.join();
+    }
+
+    unsigned size() const {
+      return _size;
+    }
+
+    // Call job(thread_index) on every thread of the pool and wait for
+    // them all to finish.
+    void run(const std::function<void(unsigned)>& job) {
+      {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_job = &job;
+	_running = _size - 1;
+	++_generation;
+      }
+      _start.notify_all();
+      job(0);
+      std::unique_lock<std::mutex> lock(_mutex);
+      _done.wait(lock, [this]() { return _running == 0; });
+      _job = nullptr;
+    }
+
+  private:
+    void work(unsigned t) {
+      unsigned long seen = 0;
+      for (;;) {
+	const std::function<void(unsigned)>* job;
+	{
+	  std::unique_lock<std::mutex> lock(_mutex);
+	  _start.wait(lock, [&]() { return _stop || _generation != seen; });
+	  if (_stop)
+	    return;
+	  seen = _generation;
+	  job = _job;
+	}
+	(*job)(t);
+	std::lock_guard<std::mutex> lock(_mutex);
+	if (--_running == 0)
+	  _done.notify_one();
+      }
+    }
+
+    unsigned _size;
+    std::vector<std::thread> _workers;
+    std::mutex _mutex;
+    std::condition_variable _start, _done;
+    const std::function<void(unsigned)>* _job;
+    unsigned long _generation;
+    unsigned _running;
+    bool _stop;
+  };
+
+  // How to hand out the iterations of a loop to threads, as with
+  // OpenMP's schedule clause.
+  //
+  // static_: chunks are dealt out round robin in advance (a chunk
+  // size of 0 means one contiguous block per thread)
+  //
+  // dynamic: each thread grabs the next chunk when it's ready
+  //
+  // guided: like dynamic, but chunks start big and shrink down to the
+  // chunk size as the work runs out
+  enum class schedule { static_, dynamic, guided };
+
+  inline const char* name(schedule s) {
+    switch (s) {
+    case schedule::static_:
+      return "static";
+    case schedule::dynamic:
+      return "dynamic";
+    default:
+      return "guided";
+    }
+  }
+
+  // Turn a name as above into a schedule, returning false if it
+  // isn't one
+  inline bool parse_schedule(const char* str, schedule& s) {
+    for (auto x: {schedule::static_, schedule::dynamic, schedule::guided})
+      if (std::strcmp(str, name(x)) == 0) {
+	s = x;
+	return true;
+      }
+    return false;
+  }
+
+  // Split [0, n) into chunks according to the schedule and call
+  // f(begin, end, thread_index) for each chunk on the pool.
+  template<class F>
+  void parallel_for(thread_pool& pool, std::size_t n, schedule sched,
+		    std::size_t chunk, F f) {
+    const unsigned nthreads = pool.size();
+    std::atomic<std::size_t> next(0);
+
+    pool.run([&](unsigned t) {
+	switch (sched) {
+	case schedule::static_:
+	  if (chunk == 0) {
+	    f(n * t / nthreads, n * (t + 1) / nthreads, t);
+	  } else {
+	    for (std::size_t b = t * chunk; b < n; b += nthreads * chunk)
+	      f(b, std::min(n, b + chunk), t);
+	  }
+	  break;
+
+	case schedule::dynamic:
+	  for (;;) {
+	    const std::size_t b = next.fetch_add(std::max<std::size_t>(chunk, 1));
+	    if (b >= n)
+	      break;
+	    f(b, std::min(n, b + std::max<std::size_t>(chunk, 1)), t);
+	  }
+	  break;
+
+	case schedule::guided:
+	  for (;;) {
+	    // Take a share of what's left, but no less than the chunk size
+	    std::size_t b = next.load();
+	    std::size_t size;
+	    do {
+	      if (b >= n)
+		return;
+	      size = std::max<std::size_t>(std::max<std::size_t>(chunk, 1),
+					   (n - b) / (2 * nthreads));
+	    } while (!next.compare_exchange_weak(b, b + size));
+	    f(b, std::min(n, b + size), t);
+	  }
+	  break;
+	}
+      });
+  }
+
+  // Call f(bounds[t], bounds[t + 1], t) on thread t of the pool, for
+  // blocks worked out in advance (e.g. from a cost_profile). bounds
+  // has one more entry than the pool has threads.
+  template<class F>
+  void parallel_blocks(thread_pool& pool, const std::vector<std::size_t>& bounds, F f) {
+    pool.run([&](unsigned t) {
+	if (bounds[t] < bounds[t + 1])
+	  f(bounds[t], bounds[t + 1], t);
+      });
+  }
+
+  // Run a set of tasks that can create more tasks. f(item, thread,
+  // spawn) is called for each item, starting with the given ones, and
+  // can call spawn(new_item) to add to the work. Returns when every
+  // task is done.
+  //
+  // Tasks are kept on a stack, so threads tend to work on the
+  // newest, smallest pieces of work and the total held stays small.
+  template<class T, class F>
+  void parallel_tasks(thread_pool& pool, std::vector<T> items, F f) {
+    std::mutex mutex;
+    std::condition_variable ready;
+    // Number of tasks being run right now
+    unsigned busy = 0;
+
+    auto spawn = [&](T item) {
+      {
+	std::lock_guard<std::mutex> lock(mutex);
+	items.push_back(std::move(item));
+      }
+      ready.notify_one();
+    };
+
+    pool.run([&](unsigned t) {
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+	  // Out of work only when there are no tasks and none running
+	  // that could make more
+	  ready.wait(lock, [&]() { return !items.empty() || busy == 0; });
+	  if (items.empty())
+	    break;
+	  T item = std::move(items.back());
+	  items.pop_back();
+	  ++busy;
+	  lock.unlock();
+	  f(item, t, spawn);
+	  lock.lock();
+	  if (--busy == 0 && items.empty())
+	    ready.notify_all();
+	}
+      });
+  }
+}
+#endif
@@ -0,0 +1,208 @@
+#ifndef THREADS_TILE_CACHE_HPP
+#define THREADS_TILE_CACHE_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdint>
+#include <cstdio>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+namespace threads {
+
+  // Identifies a tile of escape counts: which grid it's part of, where
+  // in it, and how it was computed
+  struct tile_key {
+    double centre_re, centre_im;
+    double scale_re, scale_im;
+    // Grid points along each side, and along each side of a tile
+    int resolution, tile;
+    int ti, tj;
+    int maxiter;
+    const char* precision;
+
+    std::string str() const {
+      char buf[320];
+      std::snprintf(buf, sizeof(buf),
+		    "centre=%a,%a scale=%a,%a resolution=%d tile=%d at=%d,%d maxiter=%d precision=%s",
+		    centre_re, centre_im, scale_re, scale_im, resolution, tile, ti, tj,
+		    maxiter, precision);
+      return buf;
+    }
+  };
+
+  // A directory of computed tiles of escape counts, shared between runs
+  // (and between processes running at the same time).
+  //
+  // Each tile is a file named after a hash of its key, holding the key
+  // and the counts. Files are written under a temporary name and
+  // renamed into place, which is atomic, so a reader sees either the
+  // whole tile or none of it, and two writers of the same tile just
+  // both leave a correct file.
+  //
+  // The directory is kept under a size limit by throwing away the
+  // least recently used tiles. Using a tile touches its file, so the
+  // modification time is the time of last use.
+  //
+  // NB:
+  //
+  //  - the size of the directory is only rescanned when our own
+  //    writes might have taken it over the limit, so tiles written by
+  //    other processes are noticed late
+  //
+  //  - anything that goes wrong just means a miss, or a tile not
+  //    being saved
+  class tile_cache {
+  public:
+    tile_cache(const std::string& dir, std::uint64_t max_bytes)
+      : _dir(dir), _max_bytes(max_bytes), _bytes(0), _hits(0), _misses(0), _tmp(0) {
+      if (::mkdir(_dir.c_str(), 0777) != 0 && errno != EEXIST)
+	return;
+      std::vector<entry> files;
+      _bytes = scan(files);
+    }
+
+    tile_cache(const tile_cache&) = delete;
+    tile_cache& operator=(const tile_cache&) = delete;
+
+    long hits() const {
+      return _hits;
+    }
+    long misses() const {
+      return _misses;
+    }
+
+    // Fill counts with the tile for key, which should have n elements,
+    // returning false if it isn't in the cache (or the file is wrong)
+    bool load(const tile_key& key, std::size_t n, std::vector<int>& counts) {
+      const std::string name = filename(key);
+      std::FILE* f = std::fopen(name.c_str(), "rb");
+      if (!f) {
+	++_misses;
+	return false;
+      }
+      const std::string k = key.str() + "\n";
+      std::string stored(k.size(), '\0');
+      std::uint64_t stored_n = 0;
+      bool ok = std::fread(&stored[0], 1, stored.size(), f) == stored.size() && stored == k &&
+	std::fread(&stored_n, sizeof(stored_n), 1, f) == 1 && stored_n == n;
+      if (ok) {
+	counts.resize(n);
+	// All of it, and nothing after
+	ok = std::fread(counts.data(), sizeof(int), n, f) == n && std::fgetc(f) == EOF;
+      }
+      std::fclose(f);
+      if (!ok) {
+	++_misses;
+	return false;
+      }
+      // Mark it as just used
+      ::utime(name.c_str(), nullptr);
+      ++_hits;
+      return true;
+    }
+
+    // Save a tile, and make room if need be
+    bool store(const tile_key& key, const std::vector<int>& counts) {
+      const std::string name = filename(key);
+      char suffix[64];
+      std::snprintf(suffix, sizeof(suffix), ".tmp%ld.%d", long(::getpid()), _tmp++);
+      const std::string tmp = name + suffix;
+      std::FILE* f = std::fopen(tmp.c_str(), "wb");
+      if (!f)
+	return false;
+      const std::string k = key.str() + "\n";
+      const std::uint64_t n = counts.size();
+      bool ok = std::fwrite(k.data(), 1, k.size(), f) == k.size() &&
+	std::fwrite(&n, sizeof(n), 1, f) == 1 &&
+	std::fwrite(counts.data(), sizeof(int), n, f) == n;
+      ok = std::fclose(f) == 0 && ok;
+      if (ok)
+	ok = std::rename(tmp.c_str(), name.c_str()) == 0;
+      if (!ok) {
+	std::remove(tmp.c_str());
+	return false;
+      }
+      if ((_bytes += k.size() + sizeof(n) + sizeof(int) * n) > _max_bytes)
+	trim();
+      return true;
+    }
+
+  private:
+    struct entry {
+      std::string name;
+      std::time_t used;
+      std::uint64_t bytes;
+    };
+
+    std::string filename(const tile_key& key) const {
+      // 64 bit FNV-1a
+      std::uint64_t hash = 0xcbf29ce484222325ULL;
+      for (char c: key.str()) {
+	hash ^= static_cast<unsigned char>(c);
+	hash *= 0x100000001b3ULL;
+      }
+      char name[64];
+      std::snprintf(name, sizeof(name), "/%016" PRIx64 ".tile", hash);
+      return _dir + name;
+    }
+
+    // List the tiles in the directory, returning their total size
+    std::uint64_t scan(std::vector<entry>& files) const {
+      std::uint64_t total = 0;
+      DIR* d = ::opendir(_dir.c_str());
+      if (!d)
+	return 0;
+      while (struct dirent* e = ::readdir(d)) {
+	const std::string name = e->d_name;
+	if (name.size() < 5 || name.compare(name.size() - 5, 5, ".tile") != 0)
+	  continue;
+	struct stat st;
+	const std::string path = _dir + "/" + name;
+	if (::stat(path.c_str(), &st) != 0)
+	  continue;
+	files.push_back(entry{path, st.st_mtime, std::uint64_t(st.st_size)});
+	total += st.st_size;
+      }
+      ::closedir(d);
+      return total;
+    }
+
+    // Remove the least recently used tiles until we're down to three
+    // quarters of the limit, so this isn't needed again straight away
+    void trim() {
+      std::lock_guard<std::mutex> lock(_trimming);
+      std::vector<entry> files;
+      std::uint64_t total = scan(files);
+      if (total > _max_bytes) {
+	std::sort(files.begin(), files.end(),
+		  [](const entry& a, const entry& b) { return a.used < b.used; });
+	for (auto& f: files) {
+	  if (total <= _max_bytes / 4 * 3)
+	    break;
+	  // Someone else may have got there first
+	  if (std::remove(f.name.c_str()) == 0 || errno == ENOENT)
+	    total -= f.bytes;
+	}
+      }
+      _bytes = total;
+    }
+
+    std::string _dir;
+    std::uint64_t _max_bytes;
+    std::atomic<std::uint64_t> _bytes;
+    std::atomic<long> _hits, _misses;
+    std::atomic<int> _tmp;
+    std::mutex _trimming;
+  };
+}
+#endif